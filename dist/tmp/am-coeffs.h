@@ -0,0 +1 @@
+#define AM_COEFF_N_MAX 38
@@ -0,0 +1,3 @@
+#include <sys/types.h>
+#define OFF_MAX ((off_t) 0x7fffffffffffffff)
+#define OFF_MIN (-OFF_MAX - ((off_t) 1 & (off_t) -1 && ((off_t) 3 & (off_t) -1) != (off_t) 1))
@@ -123,10 +123,405 @@ struct clh2_indicesp {
 
       - `ENOLINK`: provider process was terminated prematurely.
 
+    If the `CLH2_CACHE` environment variable is set, the results are shared
+    with other processes on the same node through a shared memory object of
+    that name, so that each element is computed only once.
+
+    Requests may be made from several threads at once.  If `CLH2_COALESCE`
+    is set to a number of microseconds, small requests (up to 4096
+    elements) that different threads make within that window are merged
+    into a single run of the provider.
+
  */
 CLH2_EXTERN int clh2_request(const double **values, const char *provider,
                              size_t count, const struct clh2_indicesp *args);
 
+/** Request a tabulation of antisymmetrized matrix elements from a given
+    provider.
+
+    This is the same as `#clh2_request`, except the values are
+
+        <n1, ml1; n2, ml2 | V | n3, ml3; n4, ml4>
+      - <n1, ml1; n2, ml2 | V | n4, ml4; n3, ml3>
+
+    The direct and exchange terms are both calculated by the provider, so
+    only one value per matrix element needs to be transferred.  The array
+    must later be freed using `#clh2_free`.
+
+    Providers that do not support antisymmetrized requests fail with
+    `EPROTO`.
+
+ */
+CLH2_EXTERN int clh2_request_antisym(const double **values,
+                                     const char *provider, size_t count,
+                                     const struct clh2_indicesp *args);
+
+/** Request a tabulation of matrix elements, storing the results in a buffer
+    owned by the caller.
+
+    This is the same as `#clh2_request`, except the values are copied into
+    `values`, which must have room for `count` elements.  Nothing needs to be
+    freed afterwards.  On failure, the contents of `values` are unspecified.
+
+ */
+CLH2_EXTERN int clh2_request_into(double *values, const char *provider,
+                                  size_t count,
+                                  const struct clh2_indicesp *args);
+
+/** A request that is being built in place.
+
+    The indices of a request have to be written into a file that is shared
+    with the provider.  Rather than building an array and having
+    `#clh2_request` copy it into the file, the caller can write the indices
+    into the file directly:
+
+        clh2_builder *builder;
+        struct clh2_indicesp *args;
+        const double *values;
+        if (clh2_builder_create(&builder, &args, count)) ...;
+        // fill in args[0], ..., args[count - 1]
+        if (clh2_builder_request(builder, &values, NULL)) ...;
+        // use values[0], ..., values[count - 1]
+        clh2_free(count, values);
+
+ */
+typedef struct clh2_builder clh2_builder;
+
+/** Start building a request.
+
+    @param[out] builder
+    The newly created builder.  It must later be consumed by
+    `#clh2_builder_request` or `#clh2_builder_request_into`, or discarded
+    using `#clh2_builder_destroy`.
+
+    @param[out] args
+    An array of `count` indices to be filled in by the caller.  It remains
+    valid until the builder is consumed or discarded.
+
+    @param[in] count
+    Number of matrix elements to tabulate.
+
+    @return
+    `0` on success, or `errno` on failure.
+
+ */
+CLH2_EXTERN int clh2_builder_create(clh2_builder **builder,
+                                    struct clh2_indicesp **args,
+                                    size_t count);
+
+/** Discard a request without sending it.  Accepts `NULL`. */
+CLH2_EXTERN void clh2_builder_destroy(clh2_builder *builder);
+
+/** Send a request that was built in place.
+
+    This is the same as `#clh2_request`, except the indices are taken from
+    the builder.  The builder is consumed, regardless of whether the function
+    succeeds.
+
+ */
+CLH2_EXTERN int clh2_builder_request(clh2_builder *builder,
+                                     const double **values,
+                                     const char *provider);
+
+/** Send a request that was built in place, storing the results in a buffer
+    owned by the caller.
+
+    This is the same as `#clh2_request_into`, except the indices are taken
+    from the builder.  The builder is consumed, regardless of whether the
+    function succeeds.
+
+ */
+CLH2_EXTERN int clh2_builder_request_into(clh2_builder *builder,
+                                          double *values,
+                                          const char *provider);
+
+/** Truncation schemes of the basis, see `#clh2_spec`.  The shell of an
+    orbital is `2 n + |ml|`, counting from zero. */
+enum clh2_truncation {
+
+    /** Each of the four orbitals lies below `num_shells`. */
+    CLH2_TRUNCATE_ORBITALS,
+
+    /** In addition, the sum of the shells of the 1st and 2nd orbitals lies
+        below `num_shells`, and likewise for the 3rd and 4th. */
+    CLH2_TRUNCATE_PAIRS
+
+};
+
+/** A compact description of a set of matrix elements.
+
+    The elements are those whose orbitals satisfy the truncation scheme, in
+    the canonical order: `ml1`, `ml2`, `ml3`, and `ml4` are each iterated
+    from `1 - num_shells` upward, followed by `n1`, `n2`, `n3`, and `n4` from
+    zero upward, with `ml4` varying fastest among the `ml` values and `n4`
+    fastest overall.  This is the same order as in the output of `tabulate`.
+
+    A zero-initialized structure describes no elements at all; set at least
+    `num_shells`.
+
+ */
+struct clh2_spec {
+
+    /** Number of shells, at most 128. */
+    unsigned char num_shells;
+
+    /** The truncation scheme, one of `#clh2_truncation`. */
+    unsigned char truncation;
+
+    /** Elements whose four orbitals all lie below this shell are excluded,
+        which is useful for extending an existing table. */
+    unsigned char min_shells;
+
+    /** If nonzero, the elements with `ml1 + ml2 != ml3 + ml4` (which always
+        vanish) are included as well. */
+    unsigned char all_ml;
+
+    /** If nonzero, the elements are antisymmetrized as in
+        `#clh2_request_antisym`. */
+    unsigned char antisym;
+
+};
+
+/** Enumerate the matrix elements described by a specification.
+
+    @param[out] count
+    The number of matrix elements.  Must not be `NULL`.
+
+    @param[out] args
+    If not `NULL`, receives the indices of the matrix elements in the
+    canonical order.  It must have room for `*count` elements, which can be
+    determined by calling this function with `args` set to `NULL` first.
+
+    @param[in] spec
+    The specification.  Must not be `NULL`.
+
+    @return
+    `0` on success, `EINVAL` if the specification is invalid, or `ENOMEM` if
+    the number of elements does not fit in a `size_t`.
+
+ */
+CLH2_EXTERN int clh2_spec_enumerate(size_t *count, struct clh2_indicesp *args,
+                                    const struct clh2_spec *spec);
+
+/** Request a tabulation of the matrix elements described by a specification.
+
+    This is the same as `#clh2_request` (or `#clh2_request_antisym`), except
+    that only the specification is sent to the provider, which enumerates the
+    indices itself.  The caller does not need to build the array of indices,
+    and the values are returned in the canonical order (see `#clh2_spec`).
+    The number of values is given by `#clh2_spec_enumerate`; the array must
+    later be freed using `#clh2_free` with that count.
+
+    If `CLH2_CACHE` is set, the indices are enumerated by the caller anyway,
+    since the cache works element by element.
+
+    Providers that do not support these requests fail with `EPROTO`.
+
+ */
+CLH2_EXTERN int clh2_request_spec(const double **values, const char *provider,
+                                  const struct clh2_spec *spec);
+
+/** An orbital of the basis. */
+struct clh2_orbital {
+
+    /** The principal quantum number. */
+    unsigned char n;
+
+    /** The angular momentum projection. */
+    signed char ml;
+
+};
+
+/** Enumerate the orbitals of the basis described by a specification.
+
+    The orbitals are those in the first `num_shells` shells, ordered by `ml`
+    from `1 - num_shells` upward and then by `n` from zero upward, so the
+    orbitals of each `ml` are contiguous.  The other fields of the
+    specification are ignored.
+
+    @param[out] count
+    The number of orbitals.  Must not be `NULL`.
+
+    @param[out] orbitals
+    If not `NULL`, receives the orbitals.  It must have room for `*count`
+    elements.
+
+    @param[in] spec
+    The specification.  Must not be `NULL`.
+
+    @return
+    `0` on success, or `EINVAL` if the specification is invalid.
+
+ */
+CLH2_EXTERN int clh2_spec_orbitals(size_t *count, struct clh2_orbital *orbitals,
+                                   const struct clh2_spec *spec);
+
+/** Request the contraction of the matrix elements with a density matrix, as
+    needed for building the Fock matrix:
+
+        fock[p][r] = Σ[q, s] <p q | V | r s> density[q][s]
+
+    where the indices run over the `N` orbitals of `#clh2_spec_orbitals`.  If
+    `spec->antisym` is set, the antisymmetrized elements are used instead.
+    The elements are generated by the provider on the fly and never stored,
+    so only `O(N^2)` memory is needed on either side.  With
+    `CLH2_TRUNCATE_PAIRS`, only the elements that satisfy the truncation are
+    included.
+
+    @param[out] fock
+    An `N` by `N` array in row-major order that receives the result.  On
+    failure, its contents are unspecified.
+
+    @param[in] provider
+    The tabulation provider, as in `#clh2_request`.
+
+    @param[in] spec
+    The specification of the basis.  `min_shells` must be zero, and
+    `all_ml` is ignored.
+
+    @param[in] density
+    An `N` by `N` array in row-major order.  Entries that are zero are
+    skipped, so a density matrix that is block-diagonal in `ml` is cheaper.
+
+    @return
+    `0` on success, or `errno` on failure.  Providers that do not support
+    these requests fail with `EPROTO`.  The cache (`CLH2_CACHE`) is not
+    used.
+
+ */
+CLH2_EXTERN int clh2_request_fock(double *fock, const char *provider,
+                                  const struct clh2_spec *spec,
+                                  const double *density);
+
+/** Tabulate the matrix elements in a different single-particle basis, such
+    as the Hartree-Fock orbitals.
+
+    The new orbitals must not mix different `ml`, so the transformation is
+    given by one square block of coefficients per `ml`:
+
+        |k, ml> = Σ[n] coeffs[ml][n][k] |n, ml>
+
+    where `n` and `k` both run over the `d` orbitals with that `ml` in the
+    basis.  The elements in the new basis are
+
+        <a b | V | c d> = Σ[n1, n2, n3, n4] C1[n1][a] C2[n2][b] C3[n3][c]
+                          C4[n4][d] <n1 n2 | V | n3 n4>
+
+    (with real coefficients), which are calculated by four successive
+    quarter transformations within each combination of `ml` values.  The
+    elements of the original basis are requested from the provider one
+    channel of `ml1 + ml2` at a time, so only a single channel is ever held
+    in memory in addition to the result.
+
+    @param[out] values
+    Receives the elements of the new basis in the canonical order of
+    `#clh2_spec`, where `n` now stands for the index `k` of the new orbital
+    within its block.  The number of elements is given by
+    `#clh2_spec_enumerate`.
+
+    @param[in] provider
+    The tabulation provider, as in `#clh2_request`.
+
+    @param[in] spec
+    The specification of the basis.  The truncation must be
+    `CLH2_TRUNCATE_ORBITALS`, and `min_shells` and `all_ml` must be zero.
+    Set `antisym` to obtain the antisymmetrized elements.
+
+    @param[in] coeffs
+    An array of `2 num_shells - 1` pointers, one for each `ml` from
+    `1 - num_shells` upward.  Each points to a `d` by `d` array in row-major
+    order, indexed by `n` and then by `k`.
+
+    @return
+    `0` on success, or `errno` on failure.  On failure, the contents of
+    `values` are unspecified.
+
+ */
+CLH2_EXTERN int clh2_transform(double *values, const char *provider,
+                               const struct clh2_spec *spec,
+                               const double *const *coeffs);
+
+/** Statistics of a single run of a provider, see `#clh2_set_stats_hook`.
+
+    The times are wall-clock times in seconds.  Every request sends one or
+    more request files to the provider (e.g. once for the elements that are
+    not yet in the cache, and again for those abandoned by other processes),
+    and each of them is reported separately.
+
+ */
+struct clh2_stats {
+
+    /** The provider, as passed to the request (`NULL` for the default). */
+    const char *provider;
+
+    /** Number of cells sent to the provider, excluding the magic number. */
+    size_t count;
+
+    /** Size of the request file, which is mapped twice: once for writing
+        the request and once for reading the results. */
+    size_t bytes;
+
+    /** Time taken to create the request file in `TMPDIR` and map it. */
+    double create_time;
+
+    /** Time taken to write the request into the mapping and flush it.
+        For requests that are built in place, this includes the time the
+        caller took to fill in the indices. */
+    double write_time;
+
+    /** Time taken to start the provider and wait for it to finish. */
+    double run_time;
+
+    /** Time taken to map the results again. */
+    double map_time;
+
+    /** Time taken to check the results and copy them if needed. */
+    double read_time;
+
+    /** Page faults in the calling process during the request (minor ones
+        that were served without I/O, and major ones that were not).  Other
+        threads of the process are counted as well. */
+    long minor_faults, major_faults;
+
+    /** Page faults in the provider process.  These are measured as the
+        change in the totals of all terminated children of the process, so if
+        other threads run providers (or other children) at the same time,
+        their page faults may be included as well. */
+    long provider_minor_faults, provider_major_faults;
+
+    /** Exit status of the provider, which is negative if it was killed by a
+        signal, `127` if it could not be started, or zero if it never ran. */
+    int status;
+
+    /** `0` on success, or the `errno` returned by the request. */
+    int error;
+
+};
+
+/** A function that receives the statistics of every provider run. */
+typedef void clh2_stats_hook(void *data, const struct clh2_stats *stats);
+
+/** Install a hook that is called after every run of a provider, whether it
+    succeeds or fails.  Pass `NULL` to remove it.
+
+    @param[in] hook
+    The hook, which is called with `data` as its first argument.  The
+    statistics are only valid for the duration of the call.
+
+    @param[in] data
+    An arbitrary pointer passed on to the hook.
+
+    If no hook is installed and the `CLH2_STATS` environment variable is set
+    to a nonempty value other than `0`, the statistics are printed to
+    standard error instead, one line per run.
+
+    The hook is global; it should be set before any requests are made.  If
+    requests are made from several threads, the hook may be called from
+    any of them, including concurrently, so it must be thread-safe.
+
+ */
+CLH2_EXTERN void clh2_set_stats_hook(clh2_stats_hook *hook, void *data);
+
 /** Request a tabulation of matrix elements from a given provider.
 
     @param[in] count
@@ -140,6 +535,22 @@ CLH2_EXTERN int clh2_request(const double **values, const char *provider,
  */
 CLH2_EXTERN void clh2_free(size_t count, const double *values);
 
+/** Estimate the cost of calculating a matrix element with `clh2-am`.
+
+    @param[in] ix
+    Indices of the matrix element.  Must not be `NULL`.
+
+    @return
+    The number of iterations of the innermost loop needed to calculate the
+    matrix element, which is roughly proportional to the time taken.  The
+    count is exact as long as it is below `2^53`.
+
+    The costs of different matrix elements can be summed to estimate the
+    total cost of a request, which is useful for dividing up the work evenly.
+
+ */
+CLH2_EXTERN double clh2_element_cost(const struct clh2_indicesp *ix);
+
 #ifdef __cplusplus
 }
 #endif
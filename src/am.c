@@ -17,6 +17,8 @@
 #ifndef NAN
 # define NAN (0./0.)
 #endif
+/* √(π / 2), the common factor of the tabulated inner sums */
+#define SQRT_HALF_PI 1.2533141373155002512
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -70,6 +72,15 @@ struct clh2_ctx {
     size_t  rgamma2_size;
     double *rfac;
     size_t  rfac_size;
+    /* rows of `conv(a, b, s)` for `a, b < conv_size` */
+    double *conv;
+    size_t  conv_size;
+    /* rows of `prefac(n, m, j)` for `n < prefac_n` and `m < prefac_m` */
+    double *prefac;
+    size_t  prefac_n;
+    size_t  prefac_m;
+    /* `enum clh2_kernel` for each bucket of `N` and `M` */
+    unsigned char kernel[CLH2_NUM_BUCKETS][CLH2_NUM_BUCKETS];
 };
 
 /* Returns the `n`-th element in the array `m` (declared as a pure function
@@ -104,11 +115,84 @@ CACHE_LOADER(pow2)
 CACHE_LOADER(rgamma2)
 CACHE_LOADER(rfac)
 
+/* Offset of the `n`-th row in a triangular table. */
+static uintf tri(uintf n) { return n * (n + 1) / 2; }
+
+/* Builds the table of `conv(a, b, s)`, the coefficient of `x^s` in
+   `(1 + x)^a (1 - x)^b / (a! b!)`.  These are the truncated convolutions of
+   reciprocal factorials that appear in the `l`-sums of the matrix element.
+   The integer coefficients are generated exactly (as long as they fit in
+   the mantissa) using Pascal's rule before being normalized.  Since the
+   table is cubic in size, it grows by half rather than doubling, and is
+   rebuilt in its entirety every time. */
+static NOINLINE
+int conv_load(double **cache, size_t *size, size_t new_max) {
+    size_t new_size = new_max + new_max / 2 + 1;
+    size_t stride = 2 * new_size - 1;
+    uintf a, b, s;
+    double *c;
+    if (resize_arrayd(cache, new_size * new_size * stride))
+        return 1;
+    c = *cache;
+    for (a = 0; a != new_size; ++a)
+    for (b = 0; b != new_size; ++b) {
+        double *row = c + (a * new_size + b) * stride;
+        if (!a && !b) {
+            row[0] = 1;
+        } else if (!b) {            /* (1 + x)^a = (1 + x) (1 + x)^(a - 1) */
+            const double *prev = c + ((a - 1) * new_size) * stride;
+            row[0] = 1;
+            for (s = 1; s < a; ++s)
+                row[s] = prev[s] + prev[s - 1];
+            row[a] = 1;
+        } else {                    /* ... (1 - x)^b = (1 - x) ... */
+            const double *prev = row - stride;
+            row[0] = 1;
+            for (s = 1; s < a + b; ++s)
+                row[s] = prev[s] - prev[s - 1];
+            row[a + b] = -prev[a + b - 1];
+        }
+    }
+    for (a = 0; a != new_size; ++a)
+    for (b = 0; b != new_size; ++b) {
+        double *row = c + (a * new_size + b) * stride;
+        const double norm = rfac(a) * rfac(b);
+        for (s = 0; s <= a + b; ++s)
+            row[s] *= norm;
+    }
+    *size = new_size;
+    return 0;
+}
+
+/* Builds the table of single-particle prefactors `1 / (j! (n - j)! (j + m)!)`
+   for `j <= n`.  Each `(n, m)` has its own row, with the rows for the same
+   `m` stored contiguously.  The entire table is rebuilt when it grows. */
+static NOINLINE
+int prefac_load(double **cache, size_t *size_n, size_t *size_m,
+                size_t n_max, size_t m_max) {
+    size_t new_n = *size_n > n_max ? *size_n : (n_max < 1 ? 1 : n_max) * 2;
+    size_t new_m = *size_m > m_max ? *size_m : (m_max < 1 ? 1 : m_max) * 2;
+    uintf n, m, j;
+    if (resize_arrayd(cache, new_m * tri(new_n)))
+        return 1;
+    for (m = 0; m != new_m; ++m)
+    for (n = 0; n != new_n; ++n)
+    for (j = 0; j <= n; ++j)
+        (*cache)[m * tri(new_n) + tri(n) + j] =
+            rfac(j) * rfac(n - j) * rfac(j + m);
+    *size_n = new_n;
+    *size_m = new_m;
+    return 0;
+}
+
 /* Builds the cache for the functions up to the given maximums. */
 static int load_caches(clh2_ctx *ctx,
                       size_t pow2_max,
                       size_t rgamma2_max,
-                      size_t rfac_max) {
+                      size_t rfac_max,
+                      size_t conv_max,
+                      size_t prefac_n_max,
+                      size_t prefac_m_max) {
     /* pow2 */
     if (ctx->pow2_size <= pow2_max &&
         pow2_load(&ctx->pow2, &ctx->pow2_size, pow2_max))
@@ -121,6 +205,15 @@ static int load_caches(clh2_ctx *ctx,
     if (ctx->rfac_size <= rfac_max &&
         rfac_load(&ctx->rfac, &ctx->rfac_size, rfac_max))
         return 1;
+    /* conv */
+    if (ctx->conv_size <= conv_max &&
+        conv_load(&ctx->conv, &ctx->conv_size, conv_max))
+        return 1;
+    /* prefac */
+    if ((ctx->prefac_n <= prefac_n_max || ctx->prefac_m <= prefac_m_max) &&
+        prefac_load(&ctx->prefac, &ctx->prefac_n, &ctx->prefac_m,
+                    prefac_n_max, prefac_m_max))
+        return 1;
     return 0;
 }
 
@@ -135,11 +228,27 @@ clh2_ctx *clh2_ctx_create(void) {
     return ctx;
 }
 
+unsigned clh2_bucket(unsigned x) {
+    unsigned b = 0;
+    while (x >= 2 && b != CLH2_NUM_BUCKETS - 1) {
+        x /= 2;
+        ++b;
+    }
+    return b;
+}
+
+void clh2_ctx_set_kernel(clh2_ctx *ctx, unsigned N_bucket, unsigned M_bucket,
+                         enum clh2_kernel kernel) {
+    ctx->kernel[N_bucket][M_bucket] = (unsigned char) kernel;
+}
+
 /* Frees the context. */
 void clh2_ctx_destroy(clh2_ctx *ctx) {
     free(ctx->pow2);
     free(ctx->rgamma2);
     free(ctx->rfac);
+    free(ctx->conv);
+    free(ctx->prefac);
     free(ctx);
 }
 
@@ -148,102 +257,471 @@ void clh2_ctx_destroy(clh2_ctx *ctx) {
 #define rgamma2(x)  pure_at(ctx->rgamma2, (x))
 #define pow2(x)     pure_at(ctx->pow2,    (x))
 
-/* Calculates the Coulomb matrix element. */
-double clh2_element(clh2_ctx *ctx, const struct clh2_indices *ix) {
-    /* Relabel indices in the same order as in the original paper:
-       `<1 2||4 3>`.  Hence, the swapping of 3 and 4 here is intentional! */
-    unsigned n1 = ix->n1;
-    unsigned n2 = ix->n2;
-    unsigned n3 = ix->n4;
-    unsigned n4 = ix->n3;
-    int m1 = ix->ml1;
-    int m2 = ix->ml2;
-    int m3 = ix->ml4;
-    int m4 = ix->ml3;
-    int M1_, M2_, M3_, M4_;
-    uintf N, NM1, M, M1, M2, M3, M4, j1, j2, j3, j4, k1, k2, k3, k4;
-    double result;
+/* Returns the row of `conv(a, b, s)` for given `a` and `b`, indexed by `s`. */
+static const double *conv_row(const clh2_ctx *ctx, uintf a, uintf b) {
+    const size_t n = ctx->conv_size;
+    return ctx->conv + (a * n + b) * (2 * n - 1);
+}
+
+/* Returns the row of `prefac(n, m, j)` for given `n` and `m`, indexed by
+   `j`. */
+static const double *prefac_row(const clh2_ctx *ctx, uintf n, uintf m) {
+    return ctx->prefac + m * tri(ctx->prefac_n) + tri(n);
+}
+
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+
+/* The exact tables (if any) of the inner sums, see `gen-coeffs.c`. */
+#ifdef HAVE_AM_COEFFS
+# include "am-coeffs.h"
+# include "am-coeffs.inc"
+
+/* Index of the inner sum for `g1` to `g4` in `am_coeffs`, where
+   `g1 + g2 = g3 + g4`. */
+static size_t am_coeff_index(uintf g1, uintf g2, uintf g3) {
+    const size_t n = g1 + g2;
+    return n * (n + 1) * (2 * n + 1) / 6 + g1 * (n + 1) + g3;
+}
+#endif
+
+/* Returns whether the inner sums with `g1 + g2 = n` are in the exact
+   tables. */
+static int am_covered(uintf n) {
+#ifdef HAVE_AM_COEFFS
+    return n <= AM_COEFF_N_MAX;
+#else
+    (void) n;
+    return 0;
+#endif
+}
+
+/* Parameters of a matrix element that are shared by all terms of the outer
+   `j`-sums.  The indices are relabeled as in the original paper.  If
+   `exact` is set, the inner sums are looked up in `am_coeffs` instead, which
+   omits their common factor of `√(π / 2)`. */
+struct am_args {
+    uintf n1, n2, n3, n4;
+    uintf M1, M2, M3, M4, M;
+    uintf k1, k2, k3, k4;
+    const double *pre1, *pre2, *pre3, *pre4;
+    int exact;
+};
+
+/* Calculates the term of the outer sums for given `j1 + j4 = A` and
+   `j2 + j3 = B`, excluding the single-particle prefactors (which are the
+   only part that depends on the individual `j`s).
+
+   The inner sums over `l1` to `l4` (with `l1 + l2 = l3 + l4`) depend only on
+   `s = l1 + l2` apart from the binomial factors.  Summing those over the
+   other `l`s first turns them into convolutions, which are tabulated in
+   `conv`, leaving a single sum over `s`. */
+static double am_pair_term(const clh2_ctx *ctx, const struct am_args *a,
+                           uintf A, uintf B) {
+    double sum = 0;
+    uintf g1 = A + a->k1;
+    uintf g2 = B + a->k2;
+    uintf g3 = B + a->k3;
+    uintf g4 = A + a->k4;
+    const double *c12, *c34;
+    /* note: G1 is always odd */
+    uintf G1 = (A + B) * 2 + a->M + 1;
+    uintf s;
+#ifdef HAVE_AM_COEFFS
+    if (a->exact)
+        return minuspow(A + B) * am_coeffs[am_coeff_index(g1, g2, g3)];
+#endif
+    c12 = conv_row(ctx, g2, g1);
+    c34 = conv_row(ctx, g3, g4);
+    for (s = 0; s <= g1 + g2; ++s)
+        sum += c12[s] * c34[s] / (rgamma2(2 + 2 * s) * rgamma2(G1 - 2 * s));
+    return minuspow(A + B) * sum
+         * pow2(G1) / (rfac(g1) * rfac(g2) * rfac(g3) * rfac(g4));
+}
+
+/* Calculates the term of the outer sums for the given `j1` to `j4`. */
+static double am_term(const clh2_ctx *ctx, const struct am_args *a,
+                      uintf j1, uintf j2, uintf j3, uintf j4) {
+    return am_pair_term(ctx, a, j1 + j4, j2 + j3)
+         * (a->pre1[j1] * a->pre4[j4]) * a->pre2[j2] * a->pre3[j3];
+}
+
+/* Sums the terms for arbitrary `n1` to `n4`. */
+static double am_generic(const clh2_ctx *ctx, const struct am_args *a) {
+    double result = 0;
+    uintf j1, j2, j3, j4;
+    for (j1 = 0; j1 <= a->n1; ++j1)
+    for (j4 = 0; j4 <= a->n4; ++j4)
+    for (j2 = 0; j2 <= a->n2; ++j2)
+    for (j3 = 0; j3 <= a->n3; ++j3)
+        result += am_term(ctx, a, j1, j2, j3, j4);
+    return result;
+}
+
+/* Largest `n2 + n3` supported by `am_paired`. */
+#define AM_PAIRED_MAX 64
+
+/* Sums the terms for arbitrary `n1` to `n4`, grouping them by `A = j1 + j4`
+   and `B = j2 + j3`.  Since `am_pair_term` depends only on `A` and `B`, the
+   prefactors can be summed into the vectors `u[A]` and `v[B]` beforehand,
+   so the result is the contraction `u^T K v`.  This evaluates
+   `(n1 + n4 + 1) (n2 + n3 + 1)` terms instead of
+   `(n1 + 1) (n2 + 1) (n3 + 1) (n4 + 1)`. */
+static double am_paired(const clh2_ctx *ctx, const struct am_args *a) {
+    double v[AM_PAIRED_MAX + 1], result = 0;
+    uintf A, B, j;
+    for (B = 0; B <= a->n2 + a->n3; ++B) {
+        v[B] = 0;
+        for (j = B > a->n3 ? B - a->n3 : 0; j <= B && j <= a->n2; ++j)
+            v[B] += a->pre2[j] * a->pre3[B - j];
+    }
+    for (A = 0; A <= a->n1 + a->n4; ++A) {
+        double u = 0, row = 0;
+        for (j = A > a->n4 ? A - a->n4 : 0; j <= A && j <= a->n1; ++j)
+            u += a->pre1[j] * a->pre4[A - j];
+        for (B = 0; B <= a->n2 + a->n3; ++B)
+            row += v[B] * am_pair_term(ctx, a, A, B);
+        result += u * row;
+    }
+    return result;
+}
+
+/* The generated kernels (if any) are fully unrolled versions of `am_generic`
+   for `n1` to `n4` up to `AM_KERNEL_N_MAX`, see `gen-kernels.c`. */
+#ifdef HAVE_AM_KERNELS
+# include "am-kernels.inc"
+#endif
+
+/* Number of elements evaluated together by `am_paired_lanes`. */
+#define AM_LANES 8
+
+#ifdef HAVE_AM_COEFFS
+/* Evaluates `am_paired` for up to `AM_LANES` elements at once.  The elements
+   must share everything but `k1` to `k4`, and must be covered by the exact
+   tables.  They then share `u[A]` and `v[B]` as well, and since `g1 + g2 =
+   A + B + M / 2` is the same for all of them, they only differ in where
+   their terms lie within each block of `am_coeffs`.  The innermost loop runs
+   over the lanes in lockstep so that it can be vectorized.  Unused lanes are
+   filled with copies of the first one. */
+static void am_paired_lanes(const struct am_args *a, size_t lanes,
+                            double *result) {
+    double v[AM_PAIRED_MAX + 1], sum[AM_LANES];
+    uintf k1[AM_LANES], k3[AM_LANES];
+    uintf A, B, j;
+    size_t l;
+    for (l = 0; l != AM_LANES; ++l) {
+        k1[l] = a[l < lanes ? l : 0].k1;
+        k3[l] = a[l < lanes ? l : 0].k3;
+        sum[l] = 0;
+    }
+    for (B = 0; B <= a->n2 + a->n3; ++B) {
+        v[B] = 0;
+        for (j = B > a->n3 ? B - a->n3 : 0; j <= B && j <= a->n2; ++j)
+            v[B] += a->pre2[j] * a->pre3[B - j];
+    }
+    for (A = 0; A <= a->n1 + a->n4; ++A) {
+        double u = 0, row[AM_LANES];
+        for (j = A > a->n4 ? A - a->n4 : 0; j <= A && j <= a->n1; ++j)
+            u += a->pre1[j] * a->pre4[A - j];
+        for (l = 0; l != AM_LANES; ++l)
+            row[l] = 0;
+        for (B = 0; B <= a->n2 + a->n3; ++B) {
+            const size_t n = A + B + a->M / 2;
+            const double *c = am_coeffs + am_coeff_index(A, n - A, B);
+            const double w = minuspow(A + B) * v[B];
+            for (l = 0; l != AM_LANES; ++l)
+                row[l] += w * c[k1[l] * (n + 1) + k3[l]];
+        }
+        for (l = 0; l != AM_LANES; ++l)
+            sum[l] += u * row[l];
+    }
+    for (l = 0; l != lanes; ++l)
+        result[l] = sum[l];
+}
+#endif
+
+/* Relabels the indices in the same order as in the original paper:
+   `<1 2||4 3>`.  Hence, the swapping of 3 and 4 here is intentional!  Fills
+   in everything but `exact` and the prefactor rows.  Returns nonzero if the
+   matrix element vanishes because `ml` is not conserved. */
+static int am_relabel(const struct clh2_indices *ix, struct am_args *a) {
+    const int m1 = ix->ml1;
+    const int m2 = ix->ml2;
+    const int m3 = ix->ml4;
+    const int m4 = ix->ml3;
+    const int M1_ = abs(m1);
+    const int M2_ = abs(m2);
+    const int M3_ = abs(m3);
+    const int M4_ = abs(m4);
     if (m1 + m2 != m3 + m4)
-        return 0;
-    N = n1 + n2 + n3 + n4;
-    M1_ = abs(m1);
-    M2_ = abs(m2);
-    M3_ = abs(m3);
-    M4_ = abs(m4);
-    M1 = (uintf) M1_;
-    M2 = (uintf) M2_;
-    M3 = (uintf) M3_;
-    M4 = (uintf) M4_;
-    k1 = (uintf) (M1_ + m1 + M4_ - m4) / 2;
-    k2 = (uintf) (M2_ + m2 + M3_ - m3) / 2;
-    k3 = (uintf) (M3_ + m3 + M2_ - m2) / 2;
-    k4 = (uintf) (M4_ + m4 + M1_ - m1) / 2;
-    M = M1 + M2 + M3 + M4;
+        return 1;
+    a->n1 = ix->n1;
+    a->n2 = ix->n2;
+    a->n3 = ix->n4;
+    a->n4 = ix->n3;
+    a->M1 = (uintf) M1_;
+    a->M2 = (uintf) M2_;
+    a->M3 = (uintf) M3_;
+    a->M4 = (uintf) M4_;
+    a->M  = a->M1 + a->M2 + a->M3 + a->M4;
+    a->k1 = (uintf) (M1_ + m1 + M4_ - m4) / 2;
+    a->k2 = (uintf) (M2_ + m2 + M3_ - m3) / 2;
+    a->k3 = (uintf) (M3_ + m3 + M2_ - m2) / 2;
+    a->k4 = (uintf) (M4_ + m4 + M1_ - m1) / 2;
+    return 0;
+}
+
+/* Loads the caches needed by a relabeled matrix element and fills in the
+   rest of `a`.  Returns nonzero if the memory could not be allocated. */
+static int am_prepare(clh2_ctx *ctx, struct am_args *a) {
+    const uintf N = a->n1 + a->n2 + a->n3 + a->n4;
     /* calculate the the maximum possible arguments for `pow2`, `rgamma2`, and
        `rfac`, and then precompute them if not cached already */
-    NM1 = N + M + 1;
-    if (load_caches(ctx, N + NM1, 1 + N + NM1, 2 * NM1)) {
+    const uintf NM1 = N + a->M + 1;
+    /* since `k1 + k2 = M / 2`, the inner sums only involve `g1 + g2 <= N +
+       M / 2`, so they are covered by the exact tables up to this point */
+    a->exact = am_covered(N + a->M / 2);
+    if (load_caches(ctx, N + NM1, 1 + N + NM1, 2 * NM1, a->exact ? 0 : N + a->M,
+                    MAX(MAX(a->n1, a->n2), MAX(a->n3, a->n4)),
+                    MAX(MAX(a->M1, a->M2), MAX(a->M3, a->M4)))) {
         fprintf(stderr, "clh2_element: "
                 "can't allocate the memory needed for calculation\n");
         fflush(stderr);
-        return NAN;
-    }
-    /* calculate using the Anisimovas & Matulis formula */
-    result = 0;
-    for (j1 = 0; j1 <= n1; ++j1)
-    for (j4 = 0; j4 <= n4; ++j4)
-    for (j2 = 0; j2 <= n2; ++j2)
-    for (j3 = 0; j3 <= n3; ++j3) {
-        double sum = 0;
-        uintf g1 = j1 + j4 + k1;
-        uintf g2 = j2 + j3 + k2;
-        uintf g3 = j2 + j3 + k3;
-        uintf g4 = j1 + j4 + k4;
-        /* note: G1 is always odd */
-        uintf G1 = ((j1 + j4) + (j2 + j3)) * 2 + M + 1;
-        uintf l1, l2, l3, l4;
-        for (l1 = 0; l1 <= g1; ++l1) {
-            double sum1 = 0;
-            sum = -sum;                 /* alternating sum */
-            for (l2 = 0; l2 <= g2; ++l2) {
-                double sum2 = 0;
-                uintf l12 = l1 + l2;
-                uintf L = l12 * 2;
-                /* this is just a complicated way to restrict the sum */
-                uintf la = l12 > g3 ? l12 - g3 : 0;
-                uintf lb = g4 < l12 ? g4 : l12;
-                if (la % 2)
-                    sum2 = -sum2;       /* prepare the sign */
-                for (l4 = la; l4 <= lb; ++l4) {
-                    l3 = l12 - l4;
-                    sum2 += rfac(l3) * rfac(l4)
-                          * rfac(g3 - l3) * rfac(g4 - l4)
-                          * rfac(l2) * rfac(g2 - l2)
-                          * rfac(l1) * rfac(g1 - l1);
-                    sum2 = -sum2;       /* alternating sum */
-                }
-                if (lb % 2 == 0)
-                    sum2 = -sum2;       /* restore the sign */
-                sum1 += sum2 / rgamma2(2 + L) / rgamma2(G1 - L);
-            }
-            sum += sum1;
-         }
-        if (g1 % 2)
-            sum = -sum;                 /* restore the sign */
-        result += minuspow((j1 + j4) + (j2 + j3)) * sum
-                * rfac(j1) * rfac(j2) * rfac(j3) * rfac(j4)
-                * rfac(n1 - j1) * rfac(n2 - j2)
-                * rfac(n3 - j3) * rfac(n4 - j4)
-                * rfac(j1 + M1) * rfac(j2 + M2)
-                * rfac(j3 + M3) * rfac(j4 + M4)
-                * pow2(G1) / (rfac(g1) * rfac(g2) * rfac(g3) * rfac(g4));
+        return 1;
     }
+    a->pre1 = prefac_row(ctx, a->n1, a->M1);
+    a->pre2 = prefac_row(ctx, a->n2, a->M2);
+    a->pre3 = prefac_row(ctx, a->n3, a->M3);
+    a->pre4 = prefac_row(ctx, a->n4, a->M4);
+    return 0;
+}
+
+/* Returns the kernel chosen for a relabeled matrix element. */
+static unsigned am_kernel(const clh2_ctx *ctx, const struct am_args *a) {
+    const uintf N = a->n1 + a->n2 + a->n3 + a->n4;
+    return ctx->kernel[clh2_bucket((unsigned) N)][clh2_bucket((unsigned) a->M)];
+}
+
+/* Sums the outer `j`-sums of a prepared matrix element using the Anisimovas
+   & Matulis formula. */
+static double am_sum(const clh2_ctx *ctx, const struct am_args *a) {
+    const unsigned kernel = am_kernel(ctx, a);
+#ifdef HAVE_AM_KERNELS
+    if (kernel == CLH2_KERNEL_UNROLLED &&
+        a->n1 <= AM_KERNEL_N_MAX && a->n2 <= AM_KERNEL_N_MAX &&
+        a->n3 <= AM_KERNEL_N_MAX && a->n4 <= AM_KERNEL_N_MAX)
+        return am_kernels[((a->n1 * (AM_KERNEL_N_MAX + 1) + a->n2)
+                           * (AM_KERNEL_N_MAX + 1) + a->n3)
+                          * (AM_KERNEL_N_MAX + 1) + a->n4](ctx, a);
+#endif
+    if (kernel != CLH2_KERNEL_GENERIC && a->n2 + a->n3 <= AM_PAIRED_MAX)
+        return am_paired(ctx, a);
+    return am_generic(ctx, a);
+}
+
+/* Applies the normalization to the sum of the outer `j`-sums. */
+static double am_finish(const clh2_ctx *ctx, const struct am_args *a,
+                        double result) {
+    const uintf n1 = a->n1, n2 = a->n2, n3 = a->n3, n4 = a->n4;
+    const uintf M1 = a->M1, M2 = a->M2, M3 = a->M3, M4 = a->M4;
+    if (a->exact)
+        result *= SQRT_HALF_PI;
     return result * minuspow(M2 + M3)
          / (rfac(n1 + M1) * rfac(n2 + M2) * rfac(n3 + M3) * rfac(n4 + M4))
          * sqrt((rfac(n1 + M1) * rfac(n2 + M2) * rfac(n3 + M3) * rfac(n4 + M4))
                 / (rfac(n1) * rfac(n2) * rfac(n3) * rfac(n4)));
 }
 
+/* Calculates the Coulomb matrix element. */
+double clh2_element(clh2_ctx *ctx, const struct clh2_indices *ix) {
+    struct am_args a;
+    if (am_relabel(ix, &a))
+        return 0;
+    if (am_prepare(ctx, &a))
+        return NAN;
+    return am_finish(ctx, &a, am_sum(ctx, &a));
+}
+
+void clh2_element_batch(clh2_ctx *ctx, size_t count,
+                        const struct clh2_indices *ix, double *values) {
+    size_t i = 0;
+    while (i != count) {
+        struct am_args a[AM_LANES];
+        if (am_relabel(&ix[i], &a[0])) {
+            values[i++] = 0;
+            continue;
+        }
+        if (am_prepare(ctx, &a[0])) {
+            values[i++] = NAN;
+            continue;
+        }
+#ifdef HAVE_AM_COEFFS
+        {
+            size_t lanes = 1;
+            /* gather the following elements that differ only in `k1` to
+               `k4`, i.e. in the signs of the `ml` values */
+            if (a->exact && a->n2 + a->n3 <= AM_PAIRED_MAX &&
+                am_kernel(ctx, a) != CLH2_KERNEL_GENERIC)
+                while (lanes != AM_LANES && i + lanes != count) {
+                    struct am_args *b = &a[lanes];
+                    if (am_relabel(&ix[i + lanes], b) ||
+                        b->n1 != a->n1 || b->n2 != a->n2 ||
+                        b->n3 != a->n3 || b->n4 != a->n4 ||
+                        b->M1 != a->M1 || b->M2 != a->M2 ||
+                        b->M3 != a->M3 || b->M4 != a->M4)
+                        break;
+                    b->exact = a->exact;
+                    b->pre1 = a->pre1;
+                    b->pre2 = a->pre2;
+                    b->pre3 = a->pre3;
+                    b->pre4 = a->pre4;
+                    ++lanes;
+                }
+            if (lanes > 1) {
+                size_t l;
+                am_paired_lanes(a, lanes, values + i);
+                for (l = 0; l != lanes; ++l)
+                    values[i + l] = am_finish(ctx, &a[l], values[i + l]);
+                i += lanes;
+                continue;
+            }
+        }
+#endif
+        values[i++] = am_finish(ctx, a, am_sum(ctx, a));
+    }
+}
+
+/* Fills the block with a single value. */
+static void am_fill(double *values, size_t count, double value) {
+    size_t i;
+    for (i = 0; i != count; ++i)
+        values[i] = value;
+}
+
+/* Evaluates every element of the block by contracting the matrix of terms
+   `K[A][B]` (see `am_pair_term`), which depends only on the `ml` values,
+   with the vectors `u[A]` and `v[B]` of each element (see `am_paired`).
+   `K` is computed only once for the block, and so is `v` for each `n2` and
+   `n3`, and `u^T K` for each `n1` and `n4`, so each element costs only a
+   dot product.  Elements that are covered by the exact tables use those, as
+   in `clh2_element`, and the others use the convolutions; if the block has
+   elements of both kinds, `K` is computed both ways. */
+void clh2_element_block(clh2_ctx *ctx, const struct clh2_indices *max,
+                        double *values) {
+    const size_t count = (size_t) (max->n1 + 1) * (max->n2 + 1) *
+                         (max->n3 + 1) * (max->n4 + 1);
+    struct am_args a;
+    double *kx, *kc, *v, *u, *wx, *wc;
+    uintf Amax, Bmax, A, B, n1, n2, n3, n4, j;
+    size_t stride;
+    int any_exact;
+
+    if (am_relabel(max, &a)) {
+        am_fill(values, count, 0);
+        return;
+    }
+    if (am_prepare(ctx, &a)) {
+        am_fill(values, count, NAN);
+        return;
+    }
+
+    /* (all of the following are in terms of the relabeled indices) */
+    Amax = a.n1 + a.n4;
+    Bmax = a.n2 + a.n3;
+    stride = Bmax + 1;
+    any_exact = am_covered(a.M / 2);
+    kx = (double *) malloc((Amax + 1) * stride * sizeof(*kx));
+    kc = (double *) malloc((Amax + 1) * stride * sizeof(*kc));
+    v = (double *) malloc((a.n2 + 1) * (a.n3 + 1) * stride * sizeof(*v));
+    u = (double *) malloc((Amax + 1) * sizeof(*u));
+    wx = (double *) malloc(stride * sizeof(*wx));
+    wc = (double *) malloc(stride * sizeof(*wc));
+    if (!kx || !kc || !v || !u || !wx || !wc) {
+        fprintf(stderr, "clh2_element_block: "
+                "can't allocate the memory needed for calculation\n");
+        fflush(stderr);
+        am_fill(values, count, NAN);
+        goto done;
+    }
+
+    /* the conv tables are only loaded if some element needs them */
+    for (A = 0; A <= Amax; ++A)
+    for (B = 0; B <= Bmax; ++B) {
+        const int exact = a.exact;
+        if (any_exact && am_covered(A + B + a.M / 2)) {
+            a.exact = 1;
+            kx[A * stride + B] = am_pair_term(ctx, &a, A, B);
+        }
+        if (!exact) {
+            a.exact = 0;
+            kc[A * stride + B] = am_pair_term(ctx, &a, A, B);
+        }
+        a.exact = exact;
+    }
+
+    for (n2 = 0; n2 <= a.n2; ++n2)
+    for (n3 = 0; n3 <= a.n3; ++n3) {
+        const double *pre2 = prefac_row(ctx, n2, a.M2);
+        const double *pre3 = prefac_row(ctx, n3, a.M3);
+        double *row = v + (n2 * (a.n3 + 1) + n3) * stride;
+        for (B = 0; B <= n2 + n3; ++B) {
+            row[B] = 0;
+            for (j = B > n3 ? B - n3 : 0; j <= B && j <= n2; ++j)
+                row[B] += pre2[j] * pre3[B - j];
+        }
+    }
+
+    for (n1 = 0; n1 <= a.n1; ++n1)
+    for (n4 = 0; n4 <= a.n4; ++n4) {
+        const double *pre1 = prefac_row(ctx, n1, a.M1);
+        const double *pre4 = prefac_row(ctx, n4, a.M4);
+        for (A = 0; A <= n1 + n4; ++A) {
+            u[A] = 0;
+            for (j = A > n4 ? A - n4 : 0; j <= A && j <= n1; ++j)
+                u[A] += pre1[j] * pre4[A - j];
+        }
+
+        /* `u^T K`, where the exact `K` is only needed as far as the elements
+           with these `n1` and `n4` are covered by the exact tables */
+        for (B = 0; B <= Bmax; ++B) {
+            wx[B] = 0;
+            wc[B] = 0;
+            for (A = 0; A <= n1 + n4; ++A) {
+                if (any_exact && am_covered(n1 + n4 + B + a.M / 2))
+                    wx[B] += u[A] * kx[A * stride + B];
+                if (!a.exact)
+                    wc[B] += u[A] * kc[A * stride + B];
+            }
+        }
+
+        for (n2 = 0; n2 <= a.n2; ++n2)
+        for (n3 = 0; n3 <= a.n3; ++n3) {
+            const double *row = v + (n2 * (a.n3 + 1) + n3) * stride;
+            const double *w;
+            struct am_args b = a;
+            double sum = 0;
+            b.n1 = n1;
+            b.n2 = n2;
+            b.n3 = n3;
+            b.n4 = n4;
+            b.exact = am_covered(n1 + n2 + n3 + n4 + a.M / 2);
+            w = b.exact ? wx : wc;
+            for (B = 0; B <= n2 + n3; ++B)
+                sum += w[B] * row[B];
+            /* undo the relabeling: the 3rd and 4th particles are swapped */
+            values[((n1 * (max->n2 + 1) + n2) * (max->n3 + 1) + n4)
+                   * (max->n4 + 1) + n3] = am_finish(ctx, &b, sum);
+        }
+    }
+
+done:
+    free(kx);
+    free(kc);
+    free(v);
+    free(u);
+    free(wx);
+    free(wc);
+}
+
 #ifdef __cplusplus
 }
 #endif
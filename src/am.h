@@ -1,5 +1,6 @@
 #ifndef G_DPMPPZBSRKP7WYWCFVOCVIQJLYDMY
 #define G_DPMPPZBSRKP7WYWCFVOCVIQJLYDMY
+#include <stddef.h>
 #ifdef __cplusplus
 #include <stdexcept>
 extern "C" {
@@ -69,6 +70,52 @@ clh2_ctx *clh2_ctx_create(void);
 */
 void clh2_ctx_destroy(clh2_ctx *ctx);
 
+/** The strategies available for evaluating the outer sums of a matrix
+    element.  They all give the same results up to rounding errors. */
+enum clh2_kernel {
+
+    /** Contraction by pairs, using the unrolled kernels for small `n` (if
+        they were generated at build time). */
+    CLH2_KERNEL_UNROLLED,
+
+    /** Contraction by pairs, without the unrolled kernels. */
+    CLH2_KERNEL_PAIRED,
+
+    /** Summation over each of `j1` to `j4` separately. */
+    CLH2_KERNEL_GENERIC,
+
+    /** Number of strategies. */
+    CLH2_NUM_KERNELS
+
+};
+
+/** Number of buckets along each of `N` and `M` used to select kernels. */
+#define CLH2_NUM_BUCKETS 6
+
+/** Returns the bucket of a given `N = n1 + n2 + n3 + n4` or
+    `M = |ml1| + |ml2| + |ml3| + |ml4|`.  The buckets are `[0, 2)`, `[2, 4)`,
+    `[4, 8)`, `[8, 16)`, `[16, 32)`, and `[32, ∞)`. */
+unsigned clh2_bucket(unsigned x);
+
+/** Selects the kernel used for matrix elements in a given bucket.  By
+    default, every bucket uses `CLH2_KERNEL_UNROLLED`.
+
+    @param[in] ctx
+    Pointer to a valid context object.  Must not be `NULL`.
+
+    @param[in] N_bucket
+    Bucket of `N`, as given by `#clh2_bucket`.
+
+    @param[in] M_bucket
+    Bucket of `M`, as given by `#clh2_bucket`.
+
+    @param[in] kernel
+    The kernel to be used.
+
+*/
+void clh2_ctx_set_kernel(clh2_ctx *ctx, unsigned N_bucket, unsigned M_bucket,
+                         enum clh2_kernel kernel);
+
 /** Calculates the Coulomb matrix element in a 2D harmonic oscillator basis.
 
     Returns the matrix element of a two-particle Coulomb repulsion operator.
@@ -92,6 +139,63 @@ void clh2_ctx_destroy(clh2_ctx *ctx);
 */
 double clh2_element(clh2_ctx *ctx, const struct clh2_indices *ix);
 
+/** Calculates several Coulomb matrix elements.
+
+    This is the same as calling `#clh2_element` on each of the indices in
+    turn, except that consecutive elements that differ only in the signs of
+    the `ml` values are evaluated together, which is considerably faster.
+    Hence, the indices should be ordered so that such elements are adjacent.
+
+    @param[in] ctx
+    Pointer to a valid context object.  Must not be `NULL`.
+
+    @param[in] count
+    Number of matrix elements.
+
+    @param[in] ix
+    An array of `count` indices.  Must not be `NULL` unless `count` is zero.
+
+    @param[out] values
+    An array of `count` elements that receives the values (or `NAN` for those
+    where an error occurred).  Must not be `NULL` unless `count` is zero.
+
+    @warning
+    The context must not be shared between threads.
+
+*/
+void clh2_element_batch(clh2_ctx *ctx, size_t count,
+                        const struct clh2_indices *ix, double *values);
+
+/** Calculates every Coulomb matrix element with the given `ml` values and
+    `n` values up to the given maximums.
+
+    This gives the same results as `#clh2_element` (up to rounding), but the
+    parts that depend only on the `ml` values are shared by the whole block,
+    which is much faster than evaluating the elements one at a time if most
+    of the block is needed.
+
+    @param[in] ctx
+    Pointer to a valid context object.  Must not be `NULL`.
+
+    @param[in] max
+    The `ml` values of the block, along with the largest `n` of each
+    particle.  Must not be `NULL`.
+
+    @param[out] values
+    An array that receives the values of the
+    `(n1_max + 1) (n2_max + 1) (n3_max + 1) (n4_max + 1)` elements of the
+    block (or `NAN` if an error occurs), ordered by `n1`, then `n2`, `n3`,
+    and `n4`, i.e. the element with `n1` to `n4` is stored at
+
+        ((n1 * (n2_max + 1) + n2) * (n3_max + 1) + n3) * (n4_max + 1) + n4
+
+    @warning
+    The context must not be shared between threads.
+
+*/
+void clh2_element_block(clh2_ctx *ctx, const struct clh2_indices *max,
+                        double *values);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,121 @@
+/*
+
+measures the fixed cost of sending a request to a provider:
+
+    bench-ipc MAX_COUNT PROVIDER...
+
+for each provider, requests of 1, 10, 100, ... up to `MAX_COUNT` elements
+are timed, each repeated until about a second has passed; the request file
+is created in `TMPDIR` as usual, so running this with `TMPDIR` on tmpfs and
+on disk shows how much the file system matters
+
+comparing a provider that does no work (`clh2-zero`) against a real one
+shows the smallest batch size for which the overhead is negligible
+
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <clh2.h>
+
+/* minimum time spent on each batch size, in seconds */
+#define MIN_TIME 1.
+
+/* a provider is no longer run once a single request takes this long */
+#define MAX_TIME 30.
+
+/* the elements are all the same, so that the cost of evaluating them is
+   small and predictable */
+static const struct clh2_indicesp element = {0, 0, 0, 0, 0, 0, 0, 0};
+
+static double wall_time(void) {
+    struct timeval tv;
+    (void) gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec + 1e-6 * (double) tv.tv_usec;
+}
+
+/* accumulates the time spent in the provider process */
+static void add_run_time(void *data, const struct clh2_stats *stats) {
+    *(double *) data += stats->run_time;
+}
+
+/* Times requests of increasing size until `max_count` or `MAX_TIME` is
+   reached.  Returns nonzero on failure. */
+static int bench(const char *provider, size_t max_count) {
+    struct clh2_indicesp *args;
+    double run_time;
+    size_t count, i;
+
+    args = (struct clh2_indicesp *) malloc(max_count * sizeof(*args));
+    if (!args) {
+        fprintf(stderr, "bench-ipc: %s\n", strerror(ENOMEM));
+        return 1;
+    }
+    for (i = 0; i != max_count; ++i)
+        args[i] = element;
+
+    clh2_set_stats_hook(add_run_time, &run_time);
+    printf("%-24s %10s %6s %12s %12s %10s %9s\n", provider, "count",
+           "calls", "latency/s", "per elem/ns", "MB/s", "provider");
+    for (count = 1;; count = count > max_count / 10 ? max_count : count * 10) {
+        double start = wall_time(), elapsed, latency;
+        size_t calls = 0;
+        run_time = 0;
+        do {
+            const double *values;
+            const int e = clh2_request(&values, provider, count, args);
+            if (e) {
+                fprintf(stderr, "bench-ipc: %s: %s\n", provider, strerror(e));
+                clh2_set_stats_hook(NULL, NULL);
+                free(args);
+                return 1;
+            }
+            clh2_free(count, values);
+            ++calls;
+            elapsed = wall_time() - start;
+        } while (elapsed < MIN_TIME);
+
+        /* the request file is written once and read back once, and each
+           cell is as large as a set of indices */
+        latency = elapsed / (double) calls;
+        printf("%-24s %10lu %6lu %12.6f %12.1f %10.1f %8.1f%%\n", "",
+               (unsigned long) count, (unsigned long) calls, latency,
+               1e9 * latency / (double) count,
+               2e-6 * (double) ((count + 1) * sizeof(element)) / latency,
+               100 * run_time / elapsed);
+        fflush(stdout);
+        if (count == max_count || latency > MAX_TIME)
+            break;
+    }
+    clh2_set_stats_hook(NULL, NULL);
+    free(args);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *tmpdir = getenv("TMPDIR");
+    char *end;
+    long max_count;
+    int i;
+
+    if (argc < 3) {
+        fprintf(stderr, "Usage: bench-ipc MAX_COUNT PROVIDER...\n");
+        return EXIT_FAILURE;
+    }
+    max_count = strtol(argv[1], &end, 10);
+    if (argv[1] == end || *end || max_count < 1) {
+        fprintf(stderr, "bench-ipc: invalid MAX_COUNT: %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    if (getenv("CLH2_CACHE") && *getenv("CLH2_CACHE"))
+        fprintf(stderr, "bench-ipc: warning: CLH2_CACHE is set, so the"
+                        " providers are mostly not run at all\n");
+
+    printf("# TMPDIR=%s\n", tmpdir ? tmpdir : "/tmp");
+    for (i = 2; i != argc; ++i)
+        if (bench(argv[i], (size_t) max_count))
+            return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
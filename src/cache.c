@@ -0,0 +1,435 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "cache.h"
+#include "util.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The cache requires atomic compare-and-swap, which we get from the `__sync`
+   builtins; without them the cache is simply disabled. */
+#if defined __GNUC__ || defined __clang__
+# define HAVE_SYNC_BUILTINS
+#endif
+
+#define CACHE_MAGIC ((uint64_t) 0x68636163326c6863)
+
+/* Number of slots used if `CLH2_CACHE_SIZE` is not set.  The shared memory
+   is allocated lazily by the system, so this only reserves address space. */
+#define CACHE_DEFAULT_CAPACITY ((size_t) 1 << 20)
+
+/* Give up on an element (and compute it locally) after this many collisions;
+   this can only happen if the cache is nearly full. */
+#define CACHE_MAX_PROBES 64
+
+#define CACHE_IDENTITY_SIZE 256
+
+/* Environment variables that change the values computed by a provider (as
+   opposed to how fast they are computed), which are therefore part of the
+   identity of the cache. */
+static const char *const value_settings[] = {
+    "CLH2_GL_NODES"
+};
+
+/* One table for each kind of element request (plain and antisymmetrized). */
+#define CACHE_KINDS 2
+
+/* Seconds to wait for another process to finish setting up the cache, or to
+   finish claiming an element, before assuming it has died. */
+#define CACHE_SETUP_TIMEOUT 10.0
+
+/* Possible values of `state`, other than the PID of the process that is
+   computing the element.  Note that a freshly claimed slot is briefly in the
+   `STATE_CLAIMING` state before the PID is stored. */
+#define STATE_CLAIMING  ((uint64_t) 0)
+#define STATE_READY     (~(uint64_t) 0)
+#define STATE_ABANDONED (~(uint64_t) 1)
+
+struct cache_header {
+
+    /* Set last, once the rest of the header has been initialized. */
+    volatile uint64_t magic;
+
+    /* Number of slots per kind (a power of two). */
+    uint64_t capacity;
+
+    /* The provider that the values were computed with, along with its
+       settings (see `make_identity`). */
+    char identity[CACHE_IDENTITY_SIZE];
+
+};
+
+struct cache_slot {
+
+    /* The bitwise complement of the packed indices, or zero if empty. */
+    volatile uint64_t key;
+
+    volatile uint64_t state;
+
+    volatile double value;
+
+};
+
+struct clh2_cache {
+    struct cache_header *header;
+    struct cache_slot *slots;
+    size_t capacity;
+    size_t size;
+    uint64_t pid;
+};
+
+#ifdef HAVE_SYNC_BUILTINS
+
+static void sleep_for(double seconds) {
+    struct timespec t;
+    t.tv_sec = (time_t) seconds;
+    t.tv_nsec = (long) ((seconds - (double) t.tv_sec) * 1e9);
+    (void) nanosleep(&t, NULL);
+}
+
+/* Rounds up to a power of two (or returns zero on overflow). */
+static size_t round_up_pow2(size_t n) {
+    size_t r = 1;
+    while (r < n && r)
+        r <<= 1;
+    return r;
+}
+
+/* Reads the number of slots from `CLH2_CACHE_SIZE`, which is the number of
+   elements to be cached.  The table is kept at most half full. */
+static size_t get_capacity(void) {
+    const char *s = getenv("CLH2_CACHE_SIZE");
+    char *end;
+    unsigned long n;
+    if (!s || !*s)
+        return CACHE_DEFAULT_CAPACITY;
+    n = strtoul(s, &end, 10);
+    if (*end || !n || n > ((size_t) -1) / 4)
+        return 0;
+    return round_up_pow2((size_t) n * 2);
+}
+
+static int get_size(size_t *size, size_t capacity) {
+    const size_t max = (size_t) -1;
+    if (!capacity || capacity > (max - sizeof(struct cache_header)) /
+                                CACHE_KINDS / sizeof(struct cache_slot))
+        return 1;
+    *size = sizeof(struct cache_header) +
+            CACHE_KINDS * capacity * sizeof(struct cache_slot);
+    return 0;
+}
+
+/* Describes the provider along with the values of `value_settings`, e.g.
+   `clh2-gl CLH2_GL_NODES=8`.  Returns nonzero if it doesn't fit. */
+static int make_identity(char *identity, const char *provider) {
+    size_t i, n = strlen(provider);
+    if (n >= CACHE_IDENTITY_SIZE)
+        return 1;
+    strcpy(identity, provider);
+    for (i = 0; i != sizeof(value_settings) / sizeof(*value_settings); ++i) {
+        const char *value = getenv(value_settings[i]);
+        if (!value || !*value)
+            continue;
+        n += 2 + strlen(value_settings[i]) + strlen(value);
+        if (n >= CACHE_IDENTITY_SIZE)
+            return 1;
+        strcat(identity, " ");
+        strcat(identity, value_settings[i]);
+        strcat(identity, "=");
+        strcat(identity, value);
+    }
+    return 0;
+}
+
+/* Initializes a newly created shared memory object. */
+static void *create(int fd, size_t *size, const char *identity) {
+    const size_t capacity = get_capacity();
+    struct cache_header *header;
+    rf_off fsize;
+    void *ptr;
+    if (get_size(size, capacity) || rf_size_to_off(&fsize, *size) ||
+        ftruncate(fd, fsize))
+        return NULL;
+    ptr = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED)
+        return NULL;
+    header = (struct cache_header *) ptr;
+    header->capacity = capacity;
+    strcpy(header->identity, identity);
+    __sync_synchronize();
+    header->magic = CACHE_MAGIC;
+    return ptr;
+}
+
+/* Attaches to a shared memory object created by another process, which may
+   not have finished initializing it yet. */
+static void *attach(int fd, size_t *size) {
+    const struct cache_header *header;
+    struct stat st;
+    double waited = 0;
+    void *ptr;
+    size_t expected;
+    for (;;) {
+        if (fstat(fd, &st))
+            return NULL;
+        if (st.st_size)
+            break;
+        if (waited >= CACHE_SETUP_TIMEOUT)
+            return NULL;
+        sleep_for(0.01);
+        waited += 0.01;
+    }
+    if (rf_off_to_size(size, st.st_size) ||
+        *size < sizeof(struct cache_header))
+        return NULL;
+    ptr = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED)
+        return NULL;
+    header = (const struct cache_header *) ptr;
+    while (header->magic != CACHE_MAGIC) {
+        if (waited >= CACHE_SETUP_TIMEOUT) {
+            (void) munmap(ptr, *size);
+            return NULL;
+        }
+        sleep_for(0.01);
+        waited += 0.01;
+    }
+    __sync_synchronize();
+    if (get_size(&expected, (size_t) header->capacity) || expected != *size) {
+        (void) munmap(ptr, *size);
+        return NULL;
+    }
+    return ptr;
+}
+
+/* Set once the mismatch warning has been printed, so that it isn't
+   repeated for every request. */
+static volatile int warned_mismatch;
+
+clh2_cache *clh2_cache_open(const char *provider) {
+    const char *env = getenv("CLH2_CACHE");
+    char identity[CACHE_IDENTITY_SIZE];
+    struct cache_header *header;
+    clh2_cache *cache;
+    char *name;
+    size_t size;
+    void *ptr;
+    int fd;
+
+    if (!env || !*env)
+        return NULL;
+    if (!provider)
+        provider = "clh2-am";
+    if (make_identity(identity, provider))
+        return NULL;
+
+    /* POSIX requires the name to start with a slash */
+    name = (char *) malloc(strlen(env) + 2);
+    if (!name)
+        return NULL;
+    name[0] = '/';
+    strcpy(name + 1, env + (*env == '/'));
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd != -1) {
+        ptr = create(fd, &size, identity);
+        if (!ptr)
+            (void) shm_unlink(name);
+    } else if (errno == EEXIST) {
+        fd = shm_open(name, O_RDWR, 0);
+        ptr = fd != -1 ? attach(fd, &size) : NULL;
+    } else {
+        ptr = NULL;
+    }
+    if (fd != -1)
+        (void) rf_sclose(fd);
+    free(name);
+    if (!ptr)
+        return NULL;
+
+    /* values from a different provider (or settings) are of no use to us */
+    header = (struct cache_header *) ptr;
+    if (strncmp(header->identity, identity, CACHE_IDENTITY_SIZE)) {
+        if (!warned_mismatch) {
+            warned_mismatch = 1;
+            fprintf(stderr, "clh2: warning: not using CLH2_CACHE=%s, which "
+                    "holds values from '%.*s' rather than '%s'\n", env,
+                    CACHE_IDENTITY_SIZE - 1, header->identity, identity);
+        }
+        (void) munmap(ptr, size);
+        return NULL;
+    }
+
+    cache = (clh2_cache *) malloc(sizeof(*cache));
+    if (!cache) {
+        (void) munmap(ptr, size);
+        return NULL;
+    }
+    cache->header = header;
+    cache->slots = (struct cache_slot *) (header + 1);
+    cache->capacity = (size_t) header->capacity;
+    cache->size = size;
+    cache->pid = (uint64_t) getpid();
+    return cache;
+}
+
+void clh2_cache_close(clh2_cache *cache) {
+    if (!cache)
+        return;
+    (void) munmap(cache->header, cache->size);
+    free(cache);
+}
+
+/* Scrambles the bits of the key (the finalizer of SplitMix64). */
+static uint64_t hash(uint64_t x) {
+    x = (x ^ (x >> 30)) * (uint64_t) 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * (uint64_t) 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+enum clh2_cache_status clh2_cache_claim(clh2_cache *cache, size_t *slot,
+                                        double *value, enum clh2_kind kind,
+                                        const struct clh2_indicesp *ix) {
+    const size_t mask = cache->capacity - 1;
+    const size_t base = (size_t) kind * cache->capacity;
+    uint64_t packed, key;
+    size_t i, probe;
+
+    if (sizeof(*ix) != sizeof(packed))
+        return CLH2_CACHE_MISS;
+    memcpy(&packed, ix, sizeof(packed));
+    key = ~packed;
+    if (!key)
+        return CLH2_CACHE_MISS;
+
+    i = (size_t) hash(packed);
+    for (probe = 0; probe != CACHE_MAX_PROBES; ++probe, ++i) {
+        struct cache_slot *s = cache->slots + base + (i & mask);
+        uint64_t state;
+        if (!s->key && __sync_bool_compare_and_swap(&s->key, 0, key)) {
+            s->state = cache->pid;
+            __sync_synchronize();
+            *slot = base + (i & mask);
+            return CLH2_CACHE_CLAIMED;
+        }
+        if (s->key != key)
+            continue;
+        *slot = base + (i & mask);
+        state = s->state;
+        if (state == STATE_READY) {
+            __sync_synchronize();
+            *value = s->value;
+            return CLH2_CACHE_READY;
+        }
+        if (state == STATE_ABANDONED &&
+            __sync_bool_compare_and_swap(&s->state, state, cache->pid))
+            return CLH2_CACHE_CLAIMED;
+        return CLH2_CACHE_PENDING;
+    }
+    return CLH2_CACHE_MISS;
+}
+
+void clh2_cache_publish(clh2_cache *cache, size_t slot, double value) {
+    struct cache_slot *s = cache->slots + slot;
+    s->value = value;
+    __sync_synchronize();
+    s->state = STATE_READY;
+}
+
+void clh2_cache_abandon(clh2_cache *cache, size_t slot) {
+    __sync_synchronize();
+    cache->slots[slot].state = STATE_ABANDONED;
+}
+
+/* Checks whether the process that claimed the element is gone. */
+static int is_dead(uint64_t pid) {
+    return (pid_t) pid <= 0 || (kill((pid_t) pid, 0) && errno == ESRCH);
+}
+
+enum clh2_cache_status clh2_cache_wait(clh2_cache *cache, size_t slot,
+                                       double *value) {
+    struct cache_slot *s = cache->slots + slot;
+    double delay = 0.001, claiming = 0;
+    for (;;) {
+        const uint64_t state = s->state;
+        int stale;
+        if (state == STATE_READY) {
+            __sync_synchronize();
+            *value = s->value;
+            return CLH2_CACHE_READY;
+        }
+        if (state == STATE_ABANDONED)
+            stale = 1;
+        else if (state == STATE_CLAIMING)
+            stale = claiming >= CACHE_SETUP_TIMEOUT;
+        else
+            stale = is_dead(state);
+        if (stale) {
+            if (__sync_bool_compare_and_swap(&s->state, state, cache->pid))
+                return CLH2_CACHE_CLAIMED;
+            continue;
+        }
+        sleep_for(delay);
+        if (state == STATE_CLAIMING)
+            claiming += delay;
+        if (delay < 0.1)
+            delay *= 2;
+    }
+}
+
+#else
+
+clh2_cache *clh2_cache_open(const char *provider) {
+    (void) provider;
+    return NULL;
+}
+
+void clh2_cache_close(clh2_cache *cache) {
+    (void) cache;
+}
+
+enum clh2_cache_status clh2_cache_claim(clh2_cache *cache, size_t *slot,
+                                        double *value, enum clh2_kind kind,
+                                        const struct clh2_indicesp *ix) {
+    (void) cache;
+    (void) slot;
+    (void) value;
+    (void) kind;
+    (void) ix;
+    return CLH2_CACHE_MISS;
+}
+
+void clh2_cache_publish(clh2_cache *cache, size_t slot, double value) {
+    (void) cache;
+    (void) slot;
+    (void) value;
+}
+
+void clh2_cache_abandon(clh2_cache *cache, size_t slot) {
+    (void) cache;
+    (void) slot;
+}
+
+enum clh2_cache_status clh2_cache_wait(clh2_cache *cache, size_t slot,
+                                       double *value) {
+    (void) cache;
+    (void) slot;
+    (void) value;
+    return CLH2_CACHE_CLAIMED;
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
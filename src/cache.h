@@ -0,0 +1,92 @@
+#ifndef G_KQ4T7WZ2MHX9CRB3VJ5ND8PLFYS6A
+#define G_KQ4T7WZ2MHX9CRB3VJ5ND8PLFYS6A
+#include <stddef.h>
+#include <clh2.h>
+#include "protocol.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** A node-wide cache of matrix elements that lives in POSIX shared memory.
+
+    Processes that request the same elements from the same provider can share
+    the results through the cache: each element is computed by whichever
+    process claims it first, and the others wait for the value to be
+    published.  The cache is enabled by setting `CLH2_CACHE` to the name of
+    the shared memory object.
+
+    The cache records the provider along with the settings that change its
+    values (such as `CLH2_GL_NODES`), and is only used by requests that
+    match both.  Use a different name for each provider or configuration.
+
+*/
+typedef struct clh2_cache clh2_cache;
+
+/** The outcome of `#clh2_cache_claim`. */
+enum clh2_cache_status {
+
+    /** The value is available. */
+    CLH2_CACHE_READY,
+
+    /** The caller is now responsible for computing and publishing the value
+        (or abandoning it). */
+    CLH2_CACHE_CLAIMED,
+
+    /** Another process is computing the value; use `#clh2_cache_wait`. */
+    CLH2_CACHE_PENDING,
+
+    /** The element can't be cached (e.g. the cache is full). */
+    CLH2_CACHE_MISS
+
+};
+
+/** Attaches to the cache named by the `CLH2_CACHE` environment variable,
+    creating it if necessary.
+
+    @return
+    A pointer to the cache, or `NULL` if the cache is disabled, if it can't
+    be opened, or if it was created for a different provider or different
+    settings (which prints a warning once).  In all of these cases, the
+    caller should simply proceed without the cache.
+
+*/
+clh2_cache *clh2_cache_open(const char *provider);
+
+/** Detaches from the cache.  The shared memory object itself is kept so
+    that later processes can reuse the results.  Accepts `NULL`. */
+void clh2_cache_close(clh2_cache *cache);
+
+/** Looks up an element, claiming it if nobody else has.
+
+    @param[out] slot
+    Receives the slot of the element, which is needed for the other
+    functions.  Not set if the result is `CLH2_CACHE_MISS`.
+
+    @param[out] value
+    Receives the value if the result is `CLH2_CACHE_READY`.
+
+*/
+enum clh2_cache_status clh2_cache_claim(clh2_cache *cache, size_t *slot,
+                                        double *value, enum clh2_kind kind,
+                                        const struct clh2_indicesp *ix);
+
+/** Publishes the value of a claimed element. */
+void clh2_cache_publish(clh2_cache *cache, size_t slot, double value);
+
+/** Gives up on a claimed element so that others can compute it instead. */
+void clh2_cache_abandon(clh2_cache *cache, size_t slot);
+
+/** Waits for a pending element to be published.
+
+    If the process that claimed the element has exited or abandoned it, the
+    claim is transferred to the caller and `CLH2_CACHE_CLAIMED` is returned.
+    Otherwise, `CLH2_CACHE_READY` is returned along with the value.
+
+*/
+enum clh2_cache_status clh2_cache_wait(clh2_cache *cache, size_t slot,
+                                       double *value);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
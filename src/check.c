@@ -1,10 +1,19 @@
 #include <errno.h>
 #include <math.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <clh2.h>
 
+/* can be overridden via the `CLH2_REF` environment variable */
 static const char *provider_ref = "clh2-ref";
 static const double abserr = 1e-6;
 static int no_ref;
@@ -140,8 +149,586 @@ static void verify_group(const char *provider,
     );
 }
 
+/* the antisymmetrized elements must agree with the difference between the
+   direct and exchange elements */
+static void verify_antisym(const char *provider,
+                           unsigned char n_max, signed char ml_max) {
+    const size_t count = calc_total(n_max, ml_max);
+    struct clh2_indicesp *ixs, *xs;
+    const double *as, *ds, *es;
+    size_t i = 0;
+    unsigned char n1, n2, n3, n4;
+    signed char ml1, ml2, ml3;
+    int e;
+
+    ixs = (struct clh2_indicesp *) malloc(sizeof(*ixs) * count * 2);
+    if (!ixs)
+        ensure(ENOMEM);
+    xs = ixs + count;
+
+    for (n1 = 0; n1 < n_max; ++n1)
+    for (n2 = 0; n2 < n_max; ++n2)
+    for (n3 = 0; n3 < n_max; ++n3)
+    for (n4 = 0; n4 < n_max; ++n4)
+    for (ml1 = (signed char) (-ml_max + 1); ml1 < ml_max; ++ml1)
+    for (ml2 = (signed char) (-ml_max + 1); ml2 < ml_max; ++ml2)
+    for (ml3 = (signed char) (-ml_max + 1); ml3 < ml_max; ++ml3) {
+        ixs[i].n1  = n1;
+        ixs[i].ml1 = ml1;
+        ixs[i].n2  = n2;
+        ixs[i].ml2 = ml2;
+        ixs[i].n3  = n3;
+        ixs[i].ml3 = ml3;
+        ixs[i].n4  = n4;
+        ixs[i].ml4 = (signed char) (ml1 + ml2 - ml3);
+        xs[i] = ixs[i];
+        xs[i].n3  = ixs[i].n4;
+        xs[i].ml3 = ixs[i].ml4;
+        xs[i].n4  = ixs[i].n3;
+        xs[i].ml4 = ixs[i].ml3;
+        ++i;
+    }
+
+    /* third-party providers might not support this */
+    e = clh2_request_antisym(&as, provider, count, ixs);
+    if (e == EPROTO) {
+        printf("NOTE: antisymmetrized requests are not supported.\n");
+        free(ixs);
+        return;
+    }
+    ensure(e);
+    ensure(clh2_request(&ds, provider, count, ixs));
+    ensure(clh2_request(&es, provider, count, xs));
+    for (i = 0; i != count; ++i)
+        verify(&ixs[i], as[i], ds[i] - es[i]);
+
+    clh2_free(count, as);
+    clh2_free(count, ds);
+    clh2_free(count, es);
+    free(ixs);
+}
+
+/* requests described by a specification must agree with the same requests
+   given as explicit lists of indices */
+static void verify_spec(const char *provider, unsigned char num_shells) {
+    struct clh2_spec specs[2];
+    size_t k;
+    memset(specs, 0, sizeof(specs));
+    specs[0].num_shells = num_shells;
+    specs[1].num_shells = num_shells;
+    specs[1].truncation = CLH2_TRUNCATE_PAIRS;
+    specs[1].min_shells = 2;
+    specs[1].all_ml = 1;
+    specs[1].antisym = 1;
+    for (k = 0; k != sizeof(specs) / sizeof(*specs); ++k) {
+        struct clh2_indicesp *ixs;
+        const double *zs, *ws;
+        size_t count, i;
+        int e;
+        ensure(clh2_spec_enumerate(&count, NULL, &specs[k]));
+        ixs = (struct clh2_indicesp *) malloc(sizeof(*ixs) * count);
+        if (!ixs)
+            ensure(ENOMEM);
+        ensure(clh2_spec_enumerate(&count, ixs, &specs[k]));
+
+        /* third-party providers might not support this */
+        e = clh2_request_spec(&zs, provider, &specs[k]);
+        if (e == EPROTO) {
+            printf("NOTE: specification requests are not supported.\n");
+            free(ixs);
+            return;
+        }
+        ensure(e);
+        ensure(specs[k].antisym ?
+               clh2_request_antisym(&ws, provider, count, ixs) :
+               clh2_request(&ws, provider, count, ixs));
+        for (i = 0; i != count; ++i)
+            verify(&ixs[i], zs[i], ws[i]);
+
+        clh2_free(count, zs);
+        clh2_free(count, ws);
+        free(ixs);
+    }
+}
+
+/* the Fock contraction must agree with the contraction of the elements
+   obtained from a specification request */
+static void verify_fock(const char *provider, unsigned char num_shells) {
+    struct clh2_spec specs[2];
+    size_t k;
+    memset(specs, 0, sizeof(specs));
+    specs[0].num_shells = num_shells;
+    specs[1].num_shells = num_shells;
+    specs[1].truncation = CLH2_TRUNCATE_PAIRS;
+    specs[1].antisym = 1;
+    for (k = 0; k != sizeof(specs) / sizeof(*specs); ++k) {
+        struct clh2_orbital *orbs;
+        struct clh2_indicesp *ixs;
+        const double *zs;
+        double *density, *fock, *ref;
+        size_t n, count, i, j;
+        int e;
+        ensure(clh2_spec_orbitals(&n, NULL, &specs[k]));
+        ensure(clh2_spec_enumerate(&count, NULL, &specs[k]));
+        orbs = (struct clh2_orbital *) malloc(sizeof(*orbs) * n);
+        ixs = (struct clh2_indicesp *) malloc(sizeof(*ixs) * count);
+        density = (double *) malloc(sizeof(*density) * n * n * 3);
+        if (!orbs || !ixs || !density)
+            ensure(ENOMEM);
+        fock = density + n * n;
+        ref = fock + n * n;
+        ensure(clh2_spec_orbitals(&n, orbs, &specs[k]));
+        ensure(clh2_spec_enumerate(&count, ixs, &specs[k]));
+
+        /* an arbitrary density matrix with some entries left out */
+        for (i = 0; i != n * n; ++i) {
+            density[i] = i % 7 ? 1. / (double) (i % 11 + 1) : 0;
+            ref[i] = 0;
+        }
+
+        /* third-party providers might not support this */
+        e = clh2_request_fock(fock, provider, &specs[k], density);
+        if (e == EPROTO) {
+            printf("NOTE: Fock requests are not supported.\n");
+            free(orbs);
+            free(ixs);
+            free(density);
+            return;
+        }
+        ensure(e);
+        ensure(clh2_request_spec(&zs, provider, &specs[k]));
+        for (i = 0; i != count; ++i) {
+            size_t p = n, q = n, r = n, s = n;
+            for (j = 0; j != n; ++j) {
+                if (orbs[j].n == ixs[i].n1 && orbs[j].ml == ixs[i].ml1)
+                    p = j;
+                if (orbs[j].n == ixs[i].n2 && orbs[j].ml == ixs[i].ml2)
+                    q = j;
+                if (orbs[j].n == ixs[i].n3 && orbs[j].ml == ixs[i].ml3)
+                    r = j;
+                if (orbs[j].n == ixs[i].n4 && orbs[j].ml == ixs[i].ml4)
+                    s = j;
+            }
+            ref[p * n + r] += zs[i] * density[q * n + s];
+        }
+        for (i = 0; i != n * n; ++i)
+            if (!(fabs(fock[i] - ref[i]) < abserr)) {
+                fprintf(stderr, "failed: Fock entry (%lu, %lu) = %.7f != "
+                        "%.7f\n", (unsigned long) (i / n),
+                        (unsigned long) (i % n), fock[i], ref[i]);
+                exit(EXIT_FAILURE);
+            }
+
+        clh2_free(count, zs);
+        free(orbs);
+        free(ixs);
+        free(density);
+    }
+}
+
+/* looks up an element of a specification request by its indices */
+static double lookup(const struct clh2_indicesp *ixs, const double *zs,
+                     size_t count, const struct clh2_indicesp *ix) {
+    size_t i;
+    for (i = 0; i != count; ++i)
+        if (!memcmp(&ixs[i], ix, sizeof(*ix)))
+            return zs[i];
+    fprintf(stderr, "check: element not found\n");
+    exit(EXIT_FAILURE);
+}
+
+/* the transformation must agree with a direct evaluation of the sums */
+static void verify_transform(const char *provider, unsigned char num_shells) {
+    const int K = num_shells;
+    struct clh2_spec spec;
+    struct clh2_indicesp *ixs;
+    const double *zs, **coeffs;
+    double *cs, *ts;
+    size_t count, i, d = (size_t) (K + 1) / 2;
+    int ml;
+
+    memset(&spec, 0, sizeof(spec));
+    spec.num_shells = num_shells;
+    spec.antisym = 1;
+    ensure(clh2_spec_enumerate(&count, NULL, &spec));
+    ixs = (struct clh2_indicesp *) malloc(sizeof(*ixs) * count);
+    ts = (double *) malloc(sizeof(*ts) * count);
+    cs = (double *) malloc(sizeof(*cs) * d * d * (size_t) (2 * K - 1));
+    coeffs = (const double **) malloc(sizeof(*coeffs) * (size_t) (2 * K - 1));
+    if (!ixs || !ts || !cs || !coeffs)
+        ensure(ENOMEM);
+    ensure(clh2_spec_enumerate(&count, ixs, &spec));
+
+    /* arbitrary coefficients, with a block size of `(K - |ml| + 1) / 2` */
+    for (ml = 1 - K; ml < K; ++ml) {
+        const size_t dm = (size_t) (K - abs(ml) + 1) / 2;
+        double *c = cs + d * d * (size_t) (ml + K - 1);
+        size_t n, k;
+        for (n = 0; n != dm; ++n)
+            for (k = 0; k != dm; ++k)
+                c[n * dm + k] = (n == k) + 1. / (double) (1 + n + 2 * k);
+        coeffs[ml + K - 1] = c;
+    }
+
+    ensure(clh2_transform(ts, provider, &spec, coeffs));
+    ensure(clh2_request_spec(&zs, provider, &spec));
+    for (i = 0; i != count; ++i) {
+        const struct clh2_indicesp *t = &ixs[i];
+        const double *c1 = coeffs[t->ml1 + K - 1],
+                     *c2 = coeffs[t->ml2 + K - 1],
+                     *c3 = coeffs[t->ml3 + K - 1],
+                     *c4 = coeffs[t->ml4 + K - 1];
+        const size_t d1 = (size_t) (K - abs(t->ml1) + 1) / 2,
+                     d2 = (size_t) (K - abs(t->ml2) + 1) / 2,
+                     d3 = (size_t) (K - abs(t->ml3) + 1) / 2,
+                     d4 = (size_t) (K - abs(t->ml4) + 1) / 2;
+        struct clh2_indicesp ix = *t;
+        double sum = 0;
+        for (ix.n1 = 0; ix.n1 != d1; ++ix.n1)
+        for (ix.n2 = 0; ix.n2 != d2; ++ix.n2)
+        for (ix.n3 = 0; ix.n3 != d3; ++ix.n3)
+        for (ix.n4 = 0; ix.n4 != d4; ++ix.n4)
+            sum += c1[ix.n1 * d1 + t->n1] * c2[ix.n2 * d2 + t->n2] *
+                   c3[ix.n3 * d3 + t->n3] * c4[ix.n4 * d4 + t->n4] *
+                   lookup(ixs, zs, count, &ix);
+        verify(t, ts[i], sum);
+    }
+
+    clh2_free(count, zs);
+    free(ixs);
+    free(ts);
+    free(cs);
+    free(coeffs);
+}
+
+struct stats_log {
+    size_t runs;
+    struct clh2_stats last;
+};
+
+static void log_stats(void *data, const struct clh2_stats *stats) {
+    struct stats_log *log = (struct stats_log *) data;
+    ++log->runs;
+    log->last = *stats;
+}
+
+/* every run of the provider must be reported (Fock requests are used since
+   they always run the provider, cache or not) */
+static void verify_stats(const char *provider) {
+    static const char *const missing = "clh2-nonexistent-provider";
+    struct clh2_spec spec;
+    struct stats_log log;
+    double fock[9], density[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+    size_t n;
+    int e;
+
+    memset(&spec, 0, sizeof(spec));
+    spec.num_shells = 2;
+    ensure(clh2_spec_orbitals(&n, NULL, &spec));
+    if (n * n > sizeof(fock) / sizeof(*fock)) {
+        fprintf(stderr, "check: unexpected number of orbitals\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&log, 0, sizeof(log));
+    clh2_set_stats_hook(log_stats, &log);
+    ensure(clh2_request_fock(fock, provider, &spec, density));
+    if (log.runs != 1 || log.last.count != n * n + 1 ||
+        log.last.status || log.last.error || log.last.provider != provider) {
+        fprintf(stderr, "check: wrong statistics for a successful run\n");
+        exit(EXIT_FAILURE);
+    }
+    e = clh2_request_fock(fock, missing, &spec, density);
+    if (!e || log.runs != 2 || log.last.error != e ||
+        (log.last.status && log.last.status != 127)) {
+        fprintf(stderr, "check: wrong statistics for a failed run\n");
+        exit(EXIT_FAILURE);
+    }
+    clh2_set_stats_hook(NULL, NULL);
+}
+
+#define NUM_THREADS 8
+
+struct thread_job {
+    const char *provider;
+    const struct clh2_indicesp *args;
+    size_t count;
+    double *values;
+    int error;
+};
+
+static void *thread_main(void *arg) {
+    struct thread_job *job = (struct thread_job *) arg;
+    job->error = clh2_request_into(job->values, job->provider,
+                                   job->count, job->args);
+    return NULL;
+}
+
+static pthread_mutex_t runs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void count_run(void *data, const struct clh2_stats *stats) {
+    (void) stats;
+    (void) pthread_mutex_lock(&runs_lock);
+    ++*(size_t *) data;
+    (void) pthread_mutex_unlock(&runs_lock);
+}
+
+/* Makes a request from several threads at once, with each thread taking a
+   slice of the elements.  Returns the number of provider runs. */
+static size_t request_threaded(const char *provider, size_t count,
+                               const struct clh2_indicesp *args,
+                               double *values) {
+    pthread_t threads[NUM_THREADS];
+    struct thread_job jobs[NUM_THREADS];
+    size_t runs = 0, i;
+    clh2_set_stats_hook(count_run, &runs);
+    for (i = 0; i != NUM_THREADS; ++i) {
+        const size_t begin = count * i / NUM_THREADS;
+        const size_t end = count * (i + 1) / NUM_THREADS;
+        jobs[i].provider = provider;
+        jobs[i].args = args + begin;
+        jobs[i].count = end - begin;
+        jobs[i].values = values + begin;
+        if (pthread_create(&threads[i], NULL, thread_main, &jobs[i]))
+            ensure(EAGAIN);
+    }
+    for (i = 0; i != NUM_THREADS; ++i) {
+        (void) pthread_join(threads[i], NULL);
+        ensure(jobs[i].error);
+    }
+    clh2_set_stats_hook(NULL, NULL);
+    return runs;
+}
+
+/* concurrent requests must give the same results as a single one, whether
+   or not they are coalesced */
+static void verify_threads(const char *provider) {
+    struct clh2_spec spec;
+    struct clh2_indicesp *args;
+    const double *zs;
+    double *ws;
+    size_t count, runs, i;
+    int pass;
+
+    memset(&spec, 0, sizeof(spec));
+    spec.num_shells = 3;
+    ensure(clh2_spec_enumerate(&count, NULL, &spec));
+    args = (struct clh2_indicesp *) malloc(count * sizeof(*args));
+    ws = (double *) malloc(count * sizeof(*ws));
+    if (!args || !ws)
+        ensure(ENOMEM);
+    ensure(clh2_spec_enumerate(&count, args, &spec));
+    ensure(clh2_request(&zs, provider, count, args));
+
+    for (pass = 0; pass != 2; ++pass) {
+        /* a long window, so that the threads are sure to make it */
+        (void) putenv(pass ? (char *) "CLH2_COALESCE=200000" :
+                             (char *) "CLH2_COALESCE=");
+        runs = request_threaded(provider, count, args, ws);
+        for (i = 0; i != count; ++i)
+            verify(&args[i], ws[i], zs[i]);
+        if (pass && runs >= NUM_THREADS &&
+            !(getenv("CLH2_CACHE") && *getenv("CLH2_CACHE"))) {
+            fprintf(stderr, "check: requests were not coalesced\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    (void) putenv((char *) "CLH2_COALESCE=");
+
+    clh2_free(count, zs);
+    free(args);
+    free(ws);
+}
+
+/* requests built in place must give the same results as plain ones */
+static void verify_builder(const char *provider, unsigned char num_shells) {
+    struct clh2_indicesp *ixs, *args;
+    struct clh2_spec spec;
+    clh2_builder *builder;
+    const double *zs, *ws;
+    double *vs;
+    size_t count, i;
+    memset(&spec, 0, sizeof(spec));
+    spec.num_shells = num_shells;
+    ensure(clh2_spec_enumerate(&count, NULL, &spec));
+    ixs = (struct clh2_indicesp *) malloc(sizeof(*ixs) * count);
+    vs = (double *) malloc(sizeof(*vs) * count);
+    if (!ixs || !vs)
+        ensure(ENOMEM);
+    ensure(clh2_spec_enumerate(&count, ixs, &spec));
+    ensure(clh2_request(&ws, provider, count, ixs));
+
+    ensure(clh2_builder_create(&builder, &args, count));
+    for (i = 0; i != count; ++i)
+        args[i] = ixs[i];
+    ensure(clh2_builder_request(builder, &zs, provider));
+    for (i = 0; i != count; ++i)
+        verify(&ixs[i], zs[i], ws[i]);
+    clh2_free(count, zs);
+
+    ensure(clh2_builder_create(&builder, &args, count));
+    for (i = 0; i != count; ++i)
+        args[i] = ixs[i];
+    ensure(clh2_builder_request_into(builder, vs, provider));
+    for (i = 0; i != count; ++i)
+        verify(&ixs[i], vs[i], ws[i]);
+
+    /* a builder that is never sent */
+    ensure(clh2_builder_create(&builder, &args, count));
+    args[0] = ixs[0];
+    clh2_builder_destroy(builder);
+    clh2_builder_destroy(NULL);
+
+    clh2_free(count, ws);
+    free(vs);
+    free(ixs);
+}
+
+/* Requests the elements in a child process, which exits successfully if the
+   values agree with `ws`.  The child gets its own process group, so that it
+   can be killed along with its provider.  If `path` is not `NULL`, it is
+   put into the environment of the child (as `PATH=...`). */
+static pid_t fork_request(const char *provider, size_t count,
+                          const struct clh2_indicesp *args, const double *ws,
+                          char *path) {
+    const double *zs;
+    size_t i;
+    pid_t pid;
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    if (pid == -1)
+        ensure(errno);
+    if (pid) {
+        (void) setpgid(pid, pid);
+        return pid;
+    }
+    (void) setpgid(0, 0);
+    if (path)
+        (void) putenv(path);
+    if (clh2_request(&zs, provider, count, args))
+        _exit(EXIT_FAILURE);
+    for (i = 0; i != count; ++i)
+        verify(&args[i], zs[i], ws[i]);
+    _exit(EXIT_SUCCESS);
+}
+
+/* Returns whether the child exited successfully. */
+static int wait_child(pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) == -1)
+        if (errno != EINTR)
+            ensure(errno);
+    return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+/* Replaces the stand-in for the provider with a script. */
+static void write_stub(const char *path, const char *script) {
+    FILE *f = fopen(path, "w");
+    if (!f || fputs(script, f) == EOF || fclose(f) || chmod(path, 0700))
+        ensure(errno ? errno : EIO);
+}
+
+/* processes that share a cache must get the same results as without it,
+   even if some of them die or fail while holding claims on the elements */
+static void verify_cache(const char *provider) {
+    const char *name = provider ? provider : "clh2-am";
+    const char *tmpdir = getenv("TMPDIR");
+    const char *old_cache = getenv("CLH2_CACHE");
+    const char *old_path = getenv("PATH");
+    static char cache_env[64];
+    char dir[256], stub[512], ready[512], script[1024], *path_env, *restore;
+    struct clh2_spec spec;
+    struct clh2_indicesp *args;
+    const double *ws;
+    size_t count;
+    pid_t a, b;
+    int tries, stubs = !strchr(name, '/');
+
+    memset(&spec, 0, sizeof(spec));
+    spec.num_shells = 4;
+    ensure(clh2_spec_enumerate(&count, NULL, &spec));
+    args = (struct clh2_indicesp *) malloc(count * sizeof(*args));
+    if (!args)
+        ensure(ENOMEM);
+    ensure(clh2_spec_enumerate(&count, args, &spec));
+
+    /* the reference values are computed before the cache is enabled */
+    (void) putenv((char *) "CLH2_CACHE=");
+    ensure(clh2_request(&ws, provider, count, args));
+    sprintf(cache_env, "CLH2_CACHE=clh2-check-%ld", (long) getpid());
+    (void) putenv(cache_env);
+
+    /* a stand-in for the provider that comes first in the `PATH` */
+    if (!tmpdir || !*tmpdir || strlen(tmpdir) > 200)
+        tmpdir = "/tmp";
+    sprintf(dir, "%s/clh2-check-%ld", tmpdir, (long) getpid());
+    stubs = stubs && strlen(name) < 200 && !mkdir(dir, 0700);
+    sprintf(stub, "%s/%s", dir, name);
+    sprintf(ready, "%s/ready", dir);
+    path_env = (char *) malloc(strlen(dir) +
+                               strlen(old_path ? old_path : "") + 7);
+    if (!path_env)
+        ensure(ENOMEM);
+    sprintf(path_env, "PATH=%s:%s", dir, old_path ? old_path : "");
+
+    if (stubs) {
+        /* claim every element and then die while computing them */
+        sprintf(script, "#!/bin/sh\n: >'%s'\nexec sleep 60\n", ready);
+        write_stub(stub, script);
+        a = fork_request(provider, count, args, ws, path_env);
+        for (tries = 0; access(ready, F_OK); ++tries) {
+            struct timespec t = {0, 10000000};
+            if (tries == 1000) {
+                fprintf(stderr, "check: stand-in provider did not start\n");
+                exit(EXIT_FAILURE);
+            }
+            (void) nanosleep(&t, NULL);
+        }
+        (void) kill(-a, SIGKILL);
+        (void) wait_child(a);
+
+        /* take over the elements of the dead process, and then fail */
+        write_stub(stub, "#!/bin/sh\nexit 1\n");
+        if (wait_child(fork_request(provider, count, args, ws, path_env))) {
+            fprintf(stderr, "check: request with a failing provider "
+                    "succeeded\n");
+            exit(EXIT_FAILURE);
+        }
+        (void) unlink(stub);
+        (void) unlink(ready);
+        (void) rmdir(dir);
+    }
+
+    /* two processes race to compute the abandoned elements */
+    a = fork_request(provider, count, args, ws, NULL);
+    b = fork_request(provider, count, args, ws, NULL);
+    if (!wait_child(a) || !wait_child(b)) {
+        fprintf(stderr, "check: cached requests failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    (void) shm_unlink(strchr(cache_env, '=') + 1);
+    restore = (char *) malloc(strlen(old_cache ? old_cache : "") + 12);
+    if (!restore)
+        ensure(ENOMEM);
+    sprintf(restore, "CLH2_CACHE=%s", old_cache ? old_cache : "");
+    (void) putenv(restore);
+    clh2_free(count, ws);
+    free(path_env);
+    free(args);
+}
+
 static void check_all(const char *provider) {
     check_weird_bug(provider);
+    verify_antisym(provider, 3, 2);
+    verify_spec(provider, 4);
+    verify_fock(provider, 4);
+    verify_transform(provider, 4);
+    verify_builder(provider, 3);
+    verify_stats(provider);
+    verify_threads(provider);
+    verify_cache(provider);
     verify_element(provider, 1, -4, 4, 0, 2, 4, 4, -8);
     verify_group(provider, 4, 2);
     if (no_ref)
@@ -151,6 +738,8 @@ static void check_all(const char *provider) {
 }
 
 int main(int argc, char **argv) {
+    if (getenv("CLH2_REF"))
+        provider_ref = getenv("CLH2_REF");
     if (argc < 2) {
         check_all(NULL);
     } else {
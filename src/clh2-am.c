@@ -1,8 +1,13 @@
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
 #include <clh2.h>
 #include "am.h"
+#include "numa.h"
 #include "protocol.h"
 
 #ifdef __cplusplus
@@ -11,36 +16,905 @@ extern "C" {
 
 static const char *prog;
 
-int main(int argc, char **argv) {
+/* Minimum number of seconds between progress reports. */
+static const double progress_interval = 1.;
+
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+/* Number of cells handed out to a thread at a time. */
+#define CHUNK_SIZE 64
+
+/* Cells that share their `ml` values are evaluated as a whole block (see
+   `clh2_element_block`) if there are at least this many of them and they
+   make up at least this fraction of the block, since the rest of the block
+   is computed and then thrown away. */
+#define BLOCK_MIN_CELLS 16
+#define BLOCK_MIN_FILL .5
+
+/* Settings for the tuning mode (`--tune`): the basis from which the sample
+   elements are drawn, the maximum number of samples per bucket, the number
+   of timed runs for each candidate (the fastest run is used), and the
+   minimum duration of a run in seconds (short runs are repeated). */
+#define TUNE_SHELLS 12
+#define TUNE_SAMPLES 1024
+#define TUNE_REPEATS 3
+#define TUNE_MIN_TIME 0.02
+
+/* Names of the kernels in the tuning file. */
+static const char *const kernel_names[CLH2_NUM_KERNELS] = {
+    "unrolled",
+    "paired",
+    "generic"
+};
+
+/* Settings loaded from the tuning file (see `load_tuning`). */
+static struct {
+    unsigned threads;
+    unsigned char kernel[CLH2_NUM_BUCKETS][CLH2_NUM_BUCKETS];
+} tuning = {1, {{0}}};
+
+/* Progress is reported to `stderr` if `CLH2_PROGRESS` is set to a nonempty
+   value other than `0`. */
+static int progress_enabled(void) {
+    const char *s = getenv("CLH2_PROGRESS");
+    return s && *s && strcmp(s, "0");
+}
+
+static double wall_time(void) {
+    struct timeval tv;
+    (void) gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec + 1e-6 * (double) tv.tv_usec;
+}
+
+static void report_progress(double done, double total, double elapsed) {
+    const double fraction = total > 0 ? done / total : 1;
+    const unsigned long eta = fraction > 0 ?
+        (unsigned long) (elapsed * (1 - fraction) / fraction + .5) : 0;
+    fprintf(stderr, "%s: %5.1f%% done, ETA %luh%02lum%02lus\n", prog,
+            fraction * 100, eta / 3600, eta / 60 % 60, eta % 60);
+    fflush(stderr);
+}
+
+/* Calculates the values of up to `CHUNK_SIZE` elements.  They are evaluated
+   with `clh2_element_batch`, so consecutive elements that differ only in the
+   signs of `ml` are computed together.  The exchange terms (if needed) are
+   batched separately right afterwards while the caches are still warm. */
+static void evaluate_indices(clh2_ctx *ctx, size_t count,
+                             const struct clh2_indicesp *ps, double *values,
+                             enum clh2_kind kind) {
+    struct clh2_indices ix[CHUNK_SIZE];
+    double exchanged[CHUNK_SIZE];
+    size_t i = 0;
+    if (!count)
+        return;
+    do
+        clh2_unpack_indices(&ix[i], &ps[i]);
+    while (++i != count);
+    clh2_element_batch(ctx, count, ix, values);
+    if (kind == CLH2_KIND_ANTISYM) {
+        for (i = 0; i != count; ++i) {
+            const struct clh2_indicesp x = clh2_exchange_indices(&ps[i]);
+            clh2_unpack_indices(&ix[i], &x);
+        }
+        clh2_element_batch(ctx, count, ix, exchanged);
+        for (i = 0; i != count; ++i)
+            values[i] -= exchanged[i];
+    }
+}
+
+/* Calculates the requested values of up to `CHUNK_SIZE` consecutive cells of
+   the sorted request. */
+static void evaluate(clh2_ctx *ctx, union clh2_cell *data,
+                     const size_t *order, size_t count, enum clh2_kind kind) {
+    struct clh2_indicesp ps[CHUNK_SIZE];
+    double values[CHUNK_SIZE];
+    size_t i;
+    for (i = 0; i != count; ++i)
+        ps[i] = data[order[i]].indices;
+    evaluate_indices(ctx, count, ps, values, kind);
+    /* the indices are overwritten by the values */
+    for (i = 0; i != count; ++i)
+        data[order[i]].value = values[i];
+}
+
+/* Cells of the request that share their `ml` values, and the bounds of the
+   block that contains them. */
+struct block {
+    struct clh2_indices max;
+    const size_t *cells;
+    size_t count;
+};
+
+/* The cells of a request, divided into blocks and the remaining cells
+   (see `find_blocks`). */
+struct block_list {
+    struct block *blocks;
+    size_t count, *cells, *rest, num_rest;
+};
+
+/* Calculates the requested values of the cells of a block.  If there isn't
+   enough memory for the block, the cells are evaluated one chunk at a time
+   instead. */
+static void evaluate_block(clh2_ctx *ctx, union clh2_cell *data,
+                           const struct block *b, enum clh2_kind kind) {
+    const unsigned d2 = b->max.n2 + 1, d3 = b->max.n3 + 1,
+                   d4 = b->max.n4 + 1;
+    const size_t size = (size_t) (b->max.n1 + 1) * d2 * d3 * d4;
+    double *values = (double *) malloc(size * sizeof(*values));
+    double *exchanged = NULL;
+    size_t i;
+    if (values && kind == CLH2_KIND_ANTISYM) {
+        struct clh2_indices x = b->max;
+        x.n3  = b->max.n4;
+        x.ml3 = b->max.ml4;
+        x.n4  = b->max.n3;
+        x.ml4 = b->max.ml3;
+        exchanged = (double *) malloc(size * sizeof(*exchanged));
+        if (exchanged)
+            clh2_element_block(ctx, &x, exchanged);
+    }
+    if (!values || (kind == CLH2_KIND_ANTISYM && !exchanged)) {
+        for (i = 0; i < b->count; i += CHUNK_SIZE)
+            evaluate(ctx, data, b->cells + i,
+                     b->count - i < CHUNK_SIZE ? b->count - i : CHUNK_SIZE,
+                     kind);
+        free(values);
+        free(exchanged);
+        return;
+    }
+    clh2_element_block(ctx, &b->max, values);
+    for (i = 0; i != b->count; ++i) {
+        union clh2_cell *c = &data[b->cells[i]];
+        const unsigned n12 = c->indices.n1 * d2 + c->indices.n2;
+        const unsigned n3 = c->indices.n3, n4 = c->indices.n4;
+        double value = values[(n12 * d3 + n3) * d4 + n4];
+        if (exchanged)
+            value -= exchanged[(n12 * d4 + n4) * d3 + n3];
+        /* the indices are overwritten by the value */
+        c->value = value;
+    }
+    free(values);
+    free(exchanged);
+}
+
+/* Position of the group of cells with the given `ml` values in
+   `find_blocks`, or `num_keys` for cells that don't conserve `ml`. */
+static size_t ml_key(const struct clh2_indicesp *p, int lo, size_t range,
+                     size_t num_keys) {
+    if (p->ml1 + p->ml2 != p->ml3 + p->ml4)
+        return num_keys;
+    return ((size_t) (p->ml1 - lo) * range + (size_t) (p->ml2 - lo)) * range
+         + (size_t) (p->ml3 - lo);
+}
+
+/* Groups the cells by their `ml` values and picks out the groups that fill
+   enough of their block to be evaluated as a whole; the other cells are
+   listed in `rest`.  The cells are grouped using a counting sort over all
+   combinations of `ml1` to `ml3` within the range of the request, so this is
+   only done if there are fewer combinations than cells (a request that is
+   any sparser is unlikely to fill its blocks anyway).  Cells that don't
+   conserve `ml` are never part of a block.  Returns nonzero if the memory
+   could not be allocated. */
+static int find_blocks(struct block_list *list, const union clh2_cell *data,
+                       size_t count) {
+    size_t *start = NULL, range = 0, num_keys = 0, used = 0, i, k;
+    int lo = 0, hi = 0;
+
+    list->count = 0;
+    list->num_rest = 0;
+    list->blocks = (struct block *)
+        malloc((count / BLOCK_MIN_CELLS + 1) * sizeof(*list->blocks));
+    list->cells = (size_t *) malloc((count ? count : 1) *
+                                    sizeof(*list->cells));
+    list->rest = (size_t *) malloc((count ? count : 1) *
+                                   sizeof(*list->rest));
+    if (!list->blocks || !list->cells || !list->rest)
+        goto fail;
+
+    for (i = 0; i != count; ++i) {
+        const struct clh2_indicesp *p = &data[i].indices;
+        const int a = MIN(MIN(p->ml1, p->ml2), MIN(p->ml3, p->ml4));
+        const int b = MAX(MAX(p->ml1, p->ml2), MAX(p->ml3, p->ml4));
+        lo = i ? MIN(lo, a) : a;
+        hi = i ? MAX(hi, b) : b;
+    }
+    if (count) {
+        range = (size_t) (hi - lo + 1);
+        num_keys = range * range * range;
+    }
+    if (num_keys > count) {
+        for (i = 0; i != count; ++i)
+            list->rest[i] = i;
+        list->num_rest = count;
+        return 0;
+    }
+
+    /* afterwards, the cells with key `k` are at `start[k]` to
+       `start[k + 1]` */
+    start = (size_t *) calloc(num_keys + 2, sizeof(*start));
+    if (!start)
+        goto fail;
+    for (i = 0; i != count; ++i)
+        ++start[ml_key(&data[i].indices, lo, range, num_keys) + 1];
+    for (k = 0; k != num_keys + 1; ++k)
+        start[k + 1] += start[k];
+    for (i = 0; i != count; ++i)
+        list->cells[start[ml_key(&data[i].indices, lo, range, num_keys)]++] = i;
+    for (k = num_keys + 1; k != 0; --k)
+        start[k] = start[k - 1];
+    start[0] = 0;
+
+    /* the cells of the blocks are moved to the front */
+    for (k = 0; k != num_keys + 1; ++k) {
+        struct block *b = list->blocks + list->count;
+        const size_t *cells = list->cells + start[k];
+        const size_t n = start[k + 1] - start[k];
+        if (k != num_keys && n >= BLOCK_MIN_CELLS) {
+            clh2_unpack_indices(&b->max, &data[cells[0]].indices);
+            for (i = 1; i != n; ++i) {
+                const struct clh2_indicesp *p = &data[cells[i]].indices;
+                b->max.n1 = MAX(b->max.n1, p->n1);
+                b->max.n2 = MAX(b->max.n2, p->n2);
+                b->max.n3 = MAX(b->max.n3, p->n3);
+                b->max.n4 = MAX(b->max.n4, p->n4);
+            }
+            if ((double) n >= BLOCK_MIN_FILL * (b->max.n1 + 1) *
+                (b->max.n2 + 1) * (b->max.n3 + 1) * (b->max.n4 + 1)) {
+                memmove(list->cells + used, cells, n * sizeof(*cells));
+                b->cells = list->cells + used;
+                b->count = n;
+                used += n;
+                ++list->count;
+                continue;
+            }
+        }
+        memcpy(list->rest + list->num_rest, cells, n * sizeof(*cells));
+        list->num_rest += n;
+    }
+    free(start);
+    return 0;
+
+fail:
+    free(list->blocks);
+    free(list->cells);
+    free(list->rest);
+    return 1;
+}
+
+/* Frees the arrays of a `block_list`. */
+static void free_blocks(struct block_list *list) {
+    free(list->blocks);
+    free(list->cells);
+    free(list->rest);
+}
+
+static double cost(const struct clh2_indicesp *p, enum clh2_kind kind) {
+    double c = clh2_element_cost(p);
+    if (kind == CLH2_KIND_ANTISYM) {
+        const struct clh2_indicesp x = clh2_exchange_indices(p);
+        c += clh2_element_cost(&x);
+    }
+    return c;
+}
+
+/* Creates a context that uses the kernels chosen in the tuning. */
+static clh2_ctx *create_ctx(void) {
     clh2_ctx *ctx = clh2_ctx_create();
+    unsigned i, j;
+    if (ctx)
+        for (i = 0; i != CLH2_NUM_BUCKETS; ++i)
+            for (j = 0; j != CLH2_NUM_BUCKETS; ++j)
+                clh2_ctx_set_kernel(ctx, i, j,
+                                    (enum clh2_kernel) tuning.kernel[i][j]);
+    return ctx;
+}
+
+/* A contiguous part of the (sorted) request. */
+struct slice {
+    const size_t *order;
+    size_t count, next;
+};
+
+/* The shared state of the threads working on a request.  The blocks are
+   handed out first, one at a time, and then the remaining cells in chunks
+   to whichever thread is free.  In NUMA mode, there is one slice per node,
+   and threads only take cells from other nodes once the slice of their own
+   node is exhausted. */
+struct job {
+    pthread_mutex_t lock;
+    union clh2_cell *data;
+    const struct block *blocks;
+    size_t num_blocks, next_block;
+    struct slice *slices;
+    unsigned num_slices;
+    enum clh2_kind kind;
+    int progress;
+    double total, done, start, last;
+};
+
+struct worker {
+    struct job *job;
+    clh2_ctx *ctx;
+    unsigned node;
+};
+
+/* The NUMA topology, if NUMA mode is enabled (`num_nodes` is zero
+   otherwise). */
+static struct clh2_numa numa;
+
+static void *work(void *arg) {
+    const struct worker *w = (const struct worker *) arg;
+    struct job *job = w->job;
+
+    /* the context tables are allocated lazily, so they end up on this node
+       as well */
+    if (numa.num_nodes)
+        (void) clh2_numa_bind(&numa, w->node);
+
+    for (;;) {
+        const struct block *b = NULL;
+        const struct slice *s = NULL;
+        size_t begin = 0, end = 0, i;
+        double done = 0;
+        unsigned k;
+
+        (void) pthread_mutex_lock(&job->lock);
+        if (job->next_block != job->num_blocks)
+            b = job->blocks + job->next_block++;
+        for (k = 0; !b && k != job->num_slices; ++k) {
+            struct slice *t = job->slices + (w->node + k) % job->num_slices;
+            if (t->next == t->count)
+                continue;
+            begin = t->next;
+            end = t->count - begin > CHUNK_SIZE ? begin + CHUNK_SIZE : t->count;
+            t->next = end;
+            s = t;
+            break;
+        }
+        if (job->progress && (b || s)) {
+            const double now = wall_time();
+            if (now - job->last >= progress_interval) {
+                report_progress(job->done, job->total, now - job->start);
+                job->last = now;
+            }
+        }
+        (void) pthread_mutex_unlock(&job->lock);
+        if (b) {
+            if (job->progress)
+                for (i = 0; i != b->count; ++i)
+                    done += cost(&job->data[b->cells[i]].indices, job->kind);
+            evaluate_block(w->ctx, job->data, b, job->kind);
+        } else if (s) {
+            if (job->progress)
+                for (i = begin; i != end; ++i)
+                    done += cost(&job->data[s->order[i]].indices, job->kind);
+            evaluate(w->ctx, job->data, s->order + begin, end - begin,
+                     job->kind);
+        } else {
+            break;
+        }
+
+        if (job->progress) {
+            (void) pthread_mutex_lock(&job->lock);
+            job->done += done;
+            (void) pthread_mutex_unlock(&job->lock);
+        }
+    }
+    return NULL;
+}
+
+/* Returns the node that the `t`-th of `threads` threads is bound to, when
+   `nodes` nodes are in use.  The threads are spread evenly across the
+   nodes. */
+static unsigned node_of(unsigned t, unsigned threads, unsigned nodes) {
+    return (unsigned) ((unsigned long) t * nodes / threads);
+}
+
+/* Divides the request into one slice per node, with the estimated cost of
+   each slice proportional to the number of threads on that node. */
+static void split(struct slice *slices, unsigned nodes, unsigned threads,
+                  const union clh2_cell *data, const size_t *order,
+                  size_t count, enum clh2_kind kind) {
+    double total = 0, sum = 0;
+    size_t i;
+    unsigned k, t = 0;
+    for (i = 0; i != count; ++i)
+        total += cost(&data[order[i]].indices, kind);
+    i = 0;
+    for (k = 0; k != nodes; ++k) {
+        double target;
+        while (t != threads && node_of(t, threads, nodes) == k)
+            ++t;
+        target = total * t / threads;
+        slices[k].order = order + i;
+        slices[k].next = 0;
+        while (i != count && (sum < target || k == nodes - 1))
+            sum += cost(&data[order[i++]].indices, kind);
+        slices[k].count = (size_t) (order + i - slices[k].order);
+    }
+}
+
+/* Evaluates the blocks (if any) and then the cells in the given order using
+   one thread per context.  If some of the threads can't be started, the
+   others pick up their share. */
+static void run(clh2_ctx *const *ctxs, unsigned threads,
+                union clh2_cell *data, const struct block_list *blocks,
+                const size_t *order, size_t count,
+                enum clh2_kind kind, int progress) {
+    const unsigned nodes = numa.num_nodes < threads ? numa.num_nodes : threads;
+    struct worker *workers;
+    struct slice whole, *slices = NULL;
+    pthread_t *ids;
+    struct job job;
+    unsigned i, started = 0;
+
+    (void) pthread_mutex_init(&job.lock, NULL);
+    job.data = data;
+    job.blocks = blocks ? blocks->blocks : NULL;
+    job.num_blocks = blocks ? blocks->count : 0;
+    job.next_block = 0;
+    job.kind = kind;
+    job.progress = progress;
+    job.total = job.done = job.start = job.last = 0;
+    if (progress) {
+        size_t j, k, total_count = count;
+        for (k = 0; k != count; ++k)
+            job.total += cost(&data[order[k]].indices, kind);
+        for (j = 0; j != job.num_blocks; ++j) {
+            const struct block *b = job.blocks + j;
+            for (k = 0; k != b->count; ++k)
+                job.total += cost(&data[b->cells[k]].indices, kind);
+            total_count += b->count;
+        }
+        fprintf(stderr, "%s: %lu element(s), ~%.3g iteration(s)\n",
+                prog, (unsigned long) total_count, job.total);
+        fflush(stderr);
+        job.start = job.last = wall_time();
+    }
+
+    if (nodes > 1)
+        slices = (struct slice *) malloc(nodes * sizeof(*slices));
+    if (slices) {
+        split(slices, nodes, threads, data, order, count, kind);
+        job.slices = slices;
+        job.num_slices = nodes;
+    } else {
+        whole.order = order;
+        whole.count = count;
+        whole.next = 0;
+        job.slices = &whole;
+        job.num_slices = 1;
+    }
+
+    workers = (struct worker *) malloc(threads * sizeof(*workers));
+    ids = (pthread_t *) malloc(threads * sizeof(*ids));
+    if (!workers || !ids)
+        threads = 1;
+    for (i = 1; i < threads; ++i) {
+        workers[i].job = &job;
+        workers[i].ctx = ctxs[i];
+        workers[i].node = node_of(i, threads, nodes ? nodes : 1);
+        if (pthread_create(&ids[started], NULL, &work, &workers[i]))
+            break;
+        ++started;
+    }
+    {
+        struct worker self;
+        self.job = &job;
+        self.ctx = ctxs[0];
+        self.node = 0;
+        (void) work(&self);
+    }
+    for (i = 0; i != started; ++i)
+        (void) pthread_join(ids[i], NULL);
+    free(workers);
+    free(ids);
+    free(slices);
+    (void) pthread_mutex_destroy(&job.lock);
+}
+
+/* The shared state of the threads working on a Fock request.  The rows of
+   the result are handed out one at a time. */
+struct fock_job {
+    pthread_mutex_t lock;
+    struct clh2_fock fock;
+    size_t next;
+};
+
+struct fock_worker {
+    struct fock_job *job;
+    clh2_ctx *ctx;
+};
+
+static double element(void *ctx, const struct clh2_indices *ix) {
+    return clh2_element((clh2_ctx *) ctx, ix);
+}
+
+static void *fock_work(void *arg) {
+    const struct fock_worker *w = (const struct fock_worker *) arg;
+    struct fock_job *job = w->job;
+    for (;;) {
+        size_t p;
+        (void) pthread_mutex_lock(&job->lock);
+        p = job->next;
+        if (p != job->fock.num_orbitals)
+            ++job->next;
+        (void) pthread_mutex_unlock(&job->lock);
+        if (p == job->fock.num_orbitals)
+            break;
+        clh2_fock_row(&job->fock, p, &element, w->ctx);
+    }
+    return NULL;
+}
+
+/* Evaluates a Fock request using one thread per context. */
+static void run_fock(clh2_ctx *const *ctxs, unsigned threads,
+                     union clh2_cell *data, size_t count) {
+    struct fock_worker *workers;
+    struct fock_job job;
+    pthread_t *ids;
+    unsigned t, started = 0;
+
+    clh2_fock_init(&job.fock, data, prog);
+    (void) pthread_mutex_init(&job.lock, NULL);
+    job.next = 0;
+
+    workers = (struct fock_worker *) malloc(threads * sizeof(*workers));
+    ids = (pthread_t *) malloc(threads * sizeof(*ids));
+    if (!workers || !ids)
+        threads = 1;
+    for (t = 1; t < threads; ++t) {
+        workers[t].job = &job;
+        workers[t].ctx = ctxs[t];
+        if (pthread_create(&ids[started], NULL, &fock_work, &workers[t]))
+            break;
+        ++started;
+    }
+    {
+        struct fock_worker self;
+        self.job = &job;
+        self.ctx = ctxs[0];
+        (void) fock_work(&self);
+    }
+    for (t = 0; t != started; ++t)
+        (void) pthread_join(ids[t], NULL);
+    free(workers);
+    free(ids);
+    (void) pthread_mutex_destroy(&job.lock);
+    clh2_fock_finish(&job.fock, data, count);
+}
+
+/* Parses a nonnegative integer, returning nonzero if it's invalid. */
+static int parse_unsigned(unsigned *x, const char *s) {
+    char *end;
+    long n = strtol(s, &end, 10);
+    if (s == end || *end || n < 0 || (unsigned long) n > (unsigned) -1)
+        return 1;
+    *x = (unsigned) n;
+    return 0;
+}
+
+/* Reads the tuning file named by `CLH2_AM_TUNING`, if any.  Each line is
+   either `threads COUNT` or `kernel N_BUCKET M_BUCKET NAME`.  Blank lines and
+   comments that start with `#` are ignored. */
+static void load_tuning(void) {
+    const char *path = getenv("CLH2_AM_TUNING");
+    char line[256];
+    unsigned lineno = 0;
+    FILE *f;
+    if (!path || !*path)
+        return;
+    f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "%s: warning: can't open %s: %s\n",
+                prog, path, strerror(errno));
+        return;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char word[16], name[16];
+        unsigned a, b, k;
+        int ok = 0;
+        ++lineno;
+        if (sscanf(line, "%15s", word) != 1 || *word == '#')
+            continue;
+        if (!strcmp(word, "threads")) {
+            ok = sscanf(line, "%*s %u", &a) == 1 && a > 0;
+            if (ok)
+                tuning.threads = a;
+        } else if (!strcmp(word, "kernel") &&
+                   sscanf(line, "%*s %u %u %15s", &a, &b, name) == 3 &&
+                   a < CLH2_NUM_BUCKETS && b < CLH2_NUM_BUCKETS) {
+            for (k = 0; k != CLH2_NUM_KERNELS; ++k)
+                if (!strcmp(name, kernel_names[k]))
+                    break;
+            ok = k != CLH2_NUM_KERNELS;
+            if (ok)
+                tuning.kernel[a][b] = (unsigned char) k;
+        }
+        if (!ok)
+            fprintf(stderr, "%s: warning: %s:%u: ignoring invalid line\n",
+                    prog, path, lineno);
+    }
+    fclose(f);
+}
+
+/* Reads the number of threads from `CLH2_THREADS`, which overrides the
+   tuning file. */
+static void load_threads(void) {
+    const char *s = getenv("CLH2_THREADS");
+    if (!s || !*s)
+        return;
+    if (parse_unsigned(&tuning.threads, s) || !tuning.threads) {
+        fprintf(stderr, "%s: invalid CLH2_THREADS: %s\n", prog, s);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Enables NUMA mode if `CLH2_NUMA` is set to a nonempty value other than
+   `0`. */
+static void load_numa(void) {
+    const char *s = getenv("CLH2_NUMA");
+    if (!s || !*s || !strcmp(s, "0"))
+        return;
+    if (clh2_numa_init(&numa)) {
+        fprintf(stderr, "%s: warning: can't determine the NUMA topology\n",
+                prog);
+        numa.num_nodes = 0;
+    }
+}
+
+static unsigned num_cpus(void) {
+#ifdef _SC_NPROCESSORS_ONLN
+    const long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > 0)
+        return (unsigned) n;
+#endif
+    return 1;
+}
+
+/* Calls `f` for every matrix element within `TUNE_SHELLS` shells. */
+#define FOR_EACH_ELEMENT(f)                                                 \
+    do {                                                                    \
+        const int K = TUNE_SHELLS;                                          \
+        int ml1, ml2, ml3, ml4, n1, n2, n3, n4;                             \
+        for (ml1 = 1 - K; ml1 < K; ++ml1)                                   \
+        for (ml2 = 1 - K; ml2 < K; ++ml2)                                   \
+        for (ml3 = 1 - K; ml3 < K; ++ml3) {                                 \
+            ml4 = ml1 + ml2 - ml3;                                          \
+            if (ml4 <= -K || ml4 >= K)                                      \
+                continue;                                                   \
+            for (n1 = 0; 2 * n1 + abs(ml1) < K; ++n1)                       \
+            for (n2 = 0; 2 * n2 + abs(ml2) < K; ++n2)                       \
+            for (n3 = 0; 2 * n3 + abs(ml3) < K; ++n3)                       \
+            for (n4 = 0; 2 * n4 + abs(ml4) < K; ++n4) {                     \
+                struct clh2_indicesp ix;                                    \
+                ix.n1  = (unsigned char) n1;                                \
+                ix.ml1 = (signed char) ml1;                                 \
+                ix.n2  = (unsigned char) n2;                                \
+                ix.ml2 = (signed char) ml2;                                 \
+                ix.n3  = (unsigned char) n3;                                \
+                ix.ml3 = (signed char) ml3;                                 \
+                ix.n4  = (unsigned char) n4;                                \
+                ix.ml4 = (signed char) ml4;                                 \
+                f;                                                          \
+            }                                                               \
+        }                                                                   \
+    } while (0)
+
+static unsigned bucket_of(const struct clh2_indicesp *ix) {
+    const unsigned N = (unsigned) ix->n1 + ix->n2 + ix->n3 + ix->n4;
+    const unsigned M = (unsigned) (abs(ix->ml1) + abs(ix->ml2) +
+                                   abs(ix->ml3) + abs(ix->ml4));
+    return clh2_bucket(N) * CLH2_NUM_BUCKETS + clh2_bucket(M);
+}
+
+/* Times the evaluation of the given cells (in order) after a warm-up run.
+   The cells are restored from `samples` before each pass.
+
+   @return
+   The fastest time per pass among several runs.
+
+*/
+static double time_run(clh2_ctx *const *ctxs, unsigned threads,
+                       union clh2_cell *cells, const union clh2_cell *samples,
+                       const size_t *order, size_t count) {
+    double best = -1;
+    unsigned r;
+    for (r = 0; r <= TUNE_REPEATS; ++r) {
+        const double start = wall_time();
+        double t;
+        unsigned passes = 0;
+        do {
+            memcpy(cells, samples, count * sizeof(*cells));
+            run(ctxs, threads, cells, NULL, order, count, CLH2_KIND_PLAIN, 0);
+            ++passes;
+            t = wall_time() - start;
+        } while (r && t < TUNE_MIN_TIME);
+        t /= passes;
+        if (r && (best < 0 || t < best))
+            best = t;
+    }
+    return best;
+}
+
+/* Times every kernel on each bucket of `N` and `M`, and then every thread
+   count up to the number of CPUs, and writes the fastest choices into the
+   tuning file. */
+static int tune(const char *path) {
+    enum { B = CLH2_NUM_BUCKETS * CLH2_NUM_BUCKETS };
+    size_t seen[B] = {0}, total[B] = {0}, offset[B + 1], taken[B] = {0};
+    size_t count, i;
+    union clh2_cell *samples, *cells;
+    size_t *order;
+    clh2_ctx **ctxs;
+    unsigned b, k, t, threads = 1, cpus = num_cpus();
+    double best_time = -1;
+    FILE *f;
+
+    /* pick up to `TUNE_SAMPLES` elements evenly from each bucket */
+    FOR_EACH_ELEMENT(++total[bucket_of(&ix)]);
+    offset[0] = 0;
+    for (b = 0; b != B; ++b)
+        offset[b + 1] = offset[b] +
+            (total[b] < TUNE_SAMPLES ? total[b] : TUNE_SAMPLES);
+    count = offset[B];
+    samples = (union clh2_cell *) malloc(count * sizeof(*samples));
+    cells = (union clh2_cell *) malloc(count * sizeof(*cells));
+    order = (size_t *) malloc(count * sizeof(*order));
+    ctxs = (clh2_ctx **) calloc(cpus, sizeof(*ctxs));
+    if (!samples || !cells || !order || !ctxs) {
+        fprintf(stderr, "%s: can't allocate memory for tuning\n", prog);
+        return EXIT_FAILURE;
+    }
+    FOR_EACH_ELEMENT({
+        const unsigned c = bucket_of(&ix);
+        const size_t n = offset[c + 1] - offset[c];
+        if (taken[c] != n && seen[c]++ * n / total[c] == taken[c])
+            samples[offset[c] + taken[c]++].indices = ix;
+    });
+    for (i = 0; i != count; ++i)
+        order[i] = i;
+
+    /* choose the kernel for each bucket */
+    for (b = 0; b != B; ++b) {
+        const size_t n = offset[b + 1] - offset[b];
+        unsigned choice = 0;
+        double best = -1;
+        if (!n)
+            continue;
+        for (k = 0; k != CLH2_NUM_KERNELS; ++k) {
+            double time;
+            tuning.kernel[b / CLH2_NUM_BUCKETS][b % CLH2_NUM_BUCKETS] =
+                (unsigned char) k;
+            ctxs[0] = create_ctx();
+            if (!ctxs[0]) {
+                fprintf(stderr, "%s: can't create context\n", prog);
+                return EXIT_FAILURE;
+            }
+            time = time_run(ctxs, 1, cells, samples + offset[b],
+                            order, n);
+            clh2_ctx_destroy(ctxs[0]);
+            if (best < 0 || time < best) {
+                best = time;
+                choice = k;
+            }
+        }
+        tuning.kernel[b / CLH2_NUM_BUCKETS][b % CLH2_NUM_BUCKETS] =
+            (unsigned char) choice;
+        fprintf(stderr, "%s: N in bucket %u, M in bucket %u: %s"
+                " (%lu sample(s), %.3g s)\n", prog,
+                b / CLH2_NUM_BUCKETS, b % CLH2_NUM_BUCKETS,
+                kernel_names[choice], (unsigned long) n, best);
+    }
+
+    /* choose the number of threads (more threads must be worth it) */
+    for (t = 0; t != cpus; ++t) {
+        ctxs[t] = create_ctx();
+        if (!ctxs[t]) {
+            fprintf(stderr, "%s: can't create context\n", prog);
+            return EXIT_FAILURE;
+        }
+    }
+    for (t = 1; t <= cpus; t = t * 2 > cpus && t != cpus ? cpus : t * 2) {
+        const double time = time_run(ctxs, t, cells, samples, order, count);
+        fprintf(stderr, "%s: %u thread(s): %.3g s\n", prog, t, time);
+        if (best_time < 0 || time < .95 * best_time) {
+            best_time = time;
+            threads = t;
+        }
+    }
+    for (t = 0; t != cpus; ++t)
+        clh2_ctx_destroy(ctxs[t]);
+
+    /* write the tuning file */
+    f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "%s: can't open %s: %s\n",
+                prog, path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    fprintf(f, "# generated by %s --tune\n"
+            "threads %u\n", prog, threads);
+    for (b = 0; b != B; ++b)
+        if (offset[b + 1] != offset[b])
+            fprintf(f, "kernel %u %u %s\n",
+                    b / CLH2_NUM_BUCKETS, b % CLH2_NUM_BUCKETS,
+                    kernel_names[tuning.kernel[b / CLH2_NUM_BUCKETS]
+                                              [b % CLH2_NUM_BUCKETS]]);
+    if (fclose(f)) {
+        fprintf(stderr, "%s: can't write %s: %s\n",
+                prog, path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    free(samples);
+    free(cells);
+    free(order);
+    free(ctxs);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    clh2_ctx **ctxs;
+    unsigned t;
+
+    if (argc == 3 && !strcmp(argv[1], "--tune")) {
+        prog = argv[0];
+        return tune(argv[2]);
+    }
+
     clh2_main_init(&prog, &argc, &argv);
+    load_tuning();
+    load_threads();
+    load_numa();
 
-    if (!ctx) {
+    /* one context per thread */
+    ctxs = (clh2_ctx **) calloc(tuning.threads, sizeof(*ctxs));
+    if (!ctxs) {
         fprintf(stderr, "%s: can't create context\n", prog);
         return EXIT_FAILURE;
     }
+    for (t = 0; t != tuning.threads; ++t) {
+        ctxs[t] = create_ctx();
+        if (!ctxs[t]) {
+            fprintf(stderr, "%s: can't create context\n", prog);
+            return EXIT_FAILURE;
+        }
+    }
 
     for (; *argv; ++argv) {
-        union clh2_cell *data, *p;
+        struct block_list blocks;
+        union clh2_cell *data;
+        enum clh2_kind kind;
         size_t count;
 
-        clh2_open_request(&data, &count, prog, *argv);
-        for (p = data; p != data + count; ++p) {
-            struct clh2_indices ix;
-            ix.n1  = p->indices.n1;
-            ix.ml1 = p->indices.ml1;
-            ix.n2  = p->indices.n2;
-            ix.ml2 = p->indices.ml2;
-            ix.n3  = p->indices.n3;
-            ix.ml3 = p->indices.ml3;
-            ix.n4  = p->indices.n4;
-            ix.ml4 = p->indices.ml4;
-            p->value = clh2_element(ctx, &ix);
+        clh2_open_request(&data, &count, &kind, prog, *argv);
+        if (kind == CLH2_KIND_FOCK) {
+            run_fock(ctxs, tuning.threads, data, count);
+            clh2_close_request(data, count);
+            continue;
+        }
+
+        /* evaluate similar elements together to keep the caches warm, and
+           elements that share their `ml` values all at once where possible */
+        if (find_blocks(&blocks, data, count) ||
+            clh2_sort_cells(blocks.rest, blocks.num_rest, data)) {
+            fprintf(stderr, "%s: can't allocate memory for sorting\n", prog);
+            return EXIT_FAILURE;
         }
+
+        run(ctxs, tuning.threads, data, &blocks, blocks.rest, blocks.num_rest,
+            kind, progress_enabled());
+        free_blocks(&blocks);
         clh2_close_request(data, count);
     }
 
-    clh2_ctx_destroy(ctx);
+    for (t = 0; t != tuning.threads; ++t)
+        clh2_ctx_destroy(ctxs[t]);
+    free(ctxs);
+    if (numa.num_nodes)
+        clh2_numa_free(&numa);
     return EXIT_SUCCESS;
 }
 
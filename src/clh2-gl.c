@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <clh2.h>
+#include "gl.h"
+#include "protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static const char *prog;
+
+static double element(void *ctx, const struct clh2_indices *ix) {
+    return clh2_gl_element((clh2_gl_ctx *) ctx, ix);
+}
+
+/* Reads the number of quadrature nodes from `CLH2_GL_NODES` (zero if
+   unspecified, which selects the number of nodes automatically). */
+static size_t get_nodes(void) {
+    const char *s = getenv("CLH2_GL_NODES");
+    char *end;
+    long n;
+    if (!s || !*s)
+        return 0;
+    n = strtol(s, &end, 10);
+    if (*end || n < 0) {
+        fprintf(stderr, "%s: invalid CLH2_GL_NODES: %s\n", prog, s);
+        exit(EXIT_FAILURE);
+    }
+    return (size_t) n;
+}
+
+int main(int argc, char **argv) {
+    clh2_gl_ctx *ctx;
+    clh2_main_init(&prog, &argc, &argv);
+
+    ctx = clh2_gl_ctx_create(get_nodes());
+    if (!ctx) {
+        fprintf(stderr, "%s: can't create context\n", prog);
+        return EXIT_FAILURE;
+    }
+
+    for (; *argv; ++argv) {
+        union clh2_cell *data, *p;
+        enum clh2_kind kind;
+        unsigned e_max = 0;
+        size_t count;
+
+        clh2_open_request(&data, &count, &kind, prog, *argv);
+        if (kind == CLH2_KIND_FOCK) {
+            struct clh2_fock f;
+            size_t i;
+            clh2_fock_init(&f, data, prog);
+            if (f.spec.num_shells &&
+                clh2_gl_ctx_reserve(ctx, f.spec.num_shells - 1u)) {
+                fprintf(stderr, "%s: can't allocate quadrature tables\n",
+                        prog);
+                return EXIT_FAILURE;
+            }
+            for (i = 0; i != f.num_orbitals; ++i)
+                clh2_fock_row(&f, i, &element, ctx);
+            clh2_fock_finish(&f, data, count);
+            clh2_close_request(data, count);
+            continue;
+        }
+
+        /* build the tables for the whole basis at once */
+        for (p = data; p != data + count; ++p) {
+            const struct clh2_indicesp *i = &p->indices;
+            unsigned e[4];
+            size_t k;
+            e[0] = 2 * (unsigned) i->n1 + (unsigned) abs(i->ml1);
+            e[1] = 2 * (unsigned) i->n2 + (unsigned) abs(i->ml2);
+            e[2] = 2 * (unsigned) i->n3 + (unsigned) abs(i->ml3);
+            e[3] = 2 * (unsigned) i->n4 + (unsigned) abs(i->ml4);
+            for (k = 0; k != sizeof(e) / sizeof(*e); ++k)
+                if (e[k] > e_max)
+                    e_max = e[k];
+        }
+        if (count && clh2_gl_ctx_reserve(ctx, e_max)) {
+            fprintf(stderr, "%s: can't allocate quadrature tables\n", prog);
+            return EXIT_FAILURE;
+        }
+
+        for (p = data; p != data + count; ++p)
+            p->value = clh2_evaluate_cell(&element, ctx, &p->indices, kind);
+        clh2_close_request(data, count);
+    }
+
+    clh2_gl_ctx_destroy(ctx);
+    return EXIT_SUCCESS;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <clh2.h>
+#include "tm.h"
+#include "protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static const char *prog;
+
+static double element(void *ctx, const struct clh2_indices *ix) {
+    return clh2_tm_element((clh2_tm_ctx *) ctx, ix);
+}
+
+int main(int argc, char **argv) {
+    clh2_tm_ctx *ctx = clh2_tm_ctx_create();
+    clh2_main_init(&prog, &argc, &argv);
+
+    if (!ctx) {
+        fprintf(stderr, "%s: can't create context\n", prog);
+        return EXIT_FAILURE;
+    }
+
+    for (; *argv; ++argv) {
+        union clh2_cell *data, *p;
+        enum clh2_kind kind;
+        size_t count;
+
+        clh2_open_request(&data, &count, &kind, prog, *argv);
+        if (kind == CLH2_KIND_FOCK) {
+            struct clh2_fock f;
+            size_t i;
+            clh2_fock_init(&f, data, prog);
+            for (i = 0; i != f.num_orbitals; ++i)
+                clh2_fock_row(&f, i, &element, ctx);
+            clh2_fock_finish(&f, data, count);
+            clh2_close_request(data, count);
+            continue;
+        }
+        for (p = data; p != data + count; ++p)
+            p->value = clh2_evaluate_cell(&element, ctx, &p->indices, kind);
+        clh2_close_request(data, count);
+    }
+
+    clh2_tm_ctx_destroy(ctx);
+    return EXIT_SUCCESS;
+}
+
+#ifdef __cplusplus
+}
+#endif
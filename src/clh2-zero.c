@@ -0,0 +1,33 @@
+/*
+
+a provider that answers every request with zeros, without evaluating
+anything; it is only used to measure the cost of the request protocol itself
+(see `bench-ipc.c`)
+
+*/
+#include <stdlib.h>
+#include <clh2.h>
+#include "protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int main(int argc, char **argv) {
+    const char *prog;
+    clh2_main_init(&prog, &argc, &argv);
+    for (; *argv; ++argv) {
+        union clh2_cell *data, *p;
+        enum clh2_kind kind;
+        size_t count;
+        clh2_open_request(&data, &count, &kind, prog, *argv);
+        for (p = data; p != data + count; ++p)
+            p->value = 0;
+        clh2_close_request(data, count);
+    }
+    return EXIT_SUCCESS;
+}
+
+#ifdef __cplusplus
+}
+#endif
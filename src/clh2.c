@@ -1,11 +1,15 @@
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <clh2.h>
+#include "cache.h"
 #include "protocol.h"
 #include "util.h"
 #include "math.inl"
@@ -16,28 +20,136 @@ static const size_t cell_size = sizeof(union clh2_cell);
 extern "C" {
 #endif
 
-int clh2_request(const double **values, const char *provider,
-                 size_t count, const struct clh2_indicesp *args) {
-    const char *argv[3] = {"clh2-am", NULL, NULL};
-    union clh2_cell *data;
-    struct rf_sigset set;
+struct clh2_builder {
+
+    /* Path to the request file, as passed to the provider. */
     char *tmpfile;
-    int e, status;
-    size_t size, new_size;
-    rf_off fsize;
+
+    /* Nonzero if the file has already been unlinked, in which case
+       `tmpfile` refers to it through `/dev/fd`. */
+    int detached;
+
+    /* The request file, and its mapping (including the magic number). */
     rf_fd fd;
-    void *ptr;
+    union clh2_cell *data;
+    size_t size;
 
-    if (!values || (count && !args))
-        return EINVAL;
+    size_t count;
 
-    if (!count) {
-        *values = NULL;
-        return 0;
+    /* Where the caller writes the indices: either the mapping itself, or a
+       separate array if the cells aren't laid out the same way. */
+    struct clh2_indicesp *args;
+
+    /* Statistics of the request, along with the time at which the current
+       phase started and the resource usage at the very beginning. */
+    struct clh2_stats stats;
+    double mark;
+    struct rusage usage;
+
+};
+
+static clh2_stats_hook *stats_hook;
+static void *stats_data;
+
+void clh2_set_stats_hook(clh2_stats_hook *hook, void *data) {
+    stats_hook = hook;
+    stats_data = data;
+}
+
+static double wall_time(void) {
+    struct timeval tv;
+    (void) gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec + 1e-6 * (double) tv.tv_usec;
+}
+
+/* Returns the time elapsed since the mark, and moves the mark to now. */
+static double lap(double *mark) {
+    const double now = wall_time(), t = now - *mark;
+    *mark = now;
+    return t;
+}
+
+/* Statistics are printed to `stderr` if `CLH2_STATS` is set to a nonempty
+   value other than `0`, unless a hook has been installed. */
+static void print_stats(const struct clh2_stats *s) {
+    const char *env = getenv("CLH2_STATS");
+    if (!env || !*env || !strcmp(env, "0"))
+        return;
+    fprintf(stderr, "clh2: provider=%s count=%lu bytes=%lu create=%.6f "
+            "write=%.6f run=%.6f map=%.6f read=%.6f faults=%ld/%ld "
+            "provider_faults=%ld/%ld status=%d error=%d\n",
+            s->provider ? s->provider : "clh2-am",
+            (unsigned long) s->count, (unsigned long) s->bytes,
+            s->create_time, s->write_time, s->run_time, s->map_time,
+            s->read_time, s->minor_faults, s->major_faults,
+            s->provider_minor_faults, s->provider_major_faults,
+            s->status, s->error);
+}
+
+/* Completes the statistics of a run and hands them out.  Returns `e`. */
+static int report_stats(struct clh2_stats *s, const struct rusage *start,
+                        double mark, int e) {
+    struct rusage usage;
+    s->read_time = lap(&mark);
+    if (!getrusage(RUSAGE_SELF, &usage)) {
+        s->minor_faults = usage.ru_minflt - start->ru_minflt;
+        s->major_faults = usage.ru_majflt - start->ru_majflt;
+    }
+    s->error = e;
+    if (stats_hook)
+        stats_hook(stats_data, s);
+    else
+        print_stats(s);
+    return e;
+}
+
+/* Releases the builder and its request file. */
+static void builder_free(clh2_builder *b) {
+    if (b->args != &b->data[1].indices)
+        free(b->args);
+    (void) rf_munmap(b->data, b->size);
+    if (b->fd != -1)
+        (void) rf_close(b->fd);
+    if (!b->detached)
+        (void) unlink(b->tmpfile);
+    free(b->tmpfile);
+    free(b);
+}
+
+/* Unlinks the request file right away if the provider can reach it through
+   `/dev/fd` instead (the descriptor is inherited by the provider), so that
+   nothing is left behind if the process is killed.  Otherwise, the file
+   keeps its name until the request is done. */
+static void builder_detach(clh2_builder *b) {
+    char *path = (char *) malloc(32);
+    if (!path)
+        return;
+    sprintf(path, "/dev/fd/%d", b->fd);
+    if (access(path, R_OK | W_OK) || unlink(b->tmpfile)) {
+        free(path);
+        return;
     }
+    free(b->tmpfile);
+    b->tmpfile = path;
+    b->detached = 1;
+}
 
-    if (provider)
-        argv[0] = provider;
+/* Creates the request file and maps it into memory. */
+static int builder_create(clh2_builder **builder, size_t count,
+                          enum clh2_kind kind) {
+    const struct clh2_indicesp *magic =
+        kind == CLH2_KIND_ANTISYM ? &clh2_magic_in_antisym : &clh2_magic_in;
+    clh2_builder *b;
+    size_t size;
+    rf_off fsize;
+    struct rusage usage;
+    double mark;
+    void *ptr;
+    int e;
+
+    mark = wall_time();
+    if (getrusage(RUSAGE_SELF, &usage))
+        memset(&usage, 0, sizeof(usage));
 
     /* calculate: size <- (count + 1) * cell_size */
     if (rf_adds(&size, count, 1))
@@ -48,64 +160,131 @@ int clh2_request(const double **values, const char *provider,
     if (rf_size_to_off(&fsize, size))
         return EFBIG;
 
-    /* block all signals for now; we rely on the child process to tell us when
-       a signal has occurred (since it is part of the same process group, it
-       receives the same signals from the terminal)
-
-       this is needed so we get a chance clean up the temporary file after a
-       signal (e.g. due to SIGINT from the user); otherwise we may end up with
-       a lot of abandoned temporary files
-
-       this isn't an ideal solution, preferably we should have "gaps" in the
-       `waitpid` call so that we can also receive signals in a timely manner.
-       however this would greatly complicate the implementation */
-    (void) rf_sigfillset(&set);
-    (void) rf_sigmask(&set, 0, set);
+    b = (clh2_builder *) malloc(sizeof(*b));
+    if (!b)
+        return ENOMEM;
 
     /* create and open a temporary file */
-    e = rf_tmpfile(&tmpfile, &fd, "clh2_req.");
-    argv[1] = tmpfile;
+    e = rf_tmpfile(&b->tmpfile, &b->fd, "clh2_req.");
     if (e) {
-        (void) rf_sigmask(NULL, 0, set);
+        free(b);
         return e;
     }
 
     /* resize file and memory map */
-    e = rf_mmapt(&ptr, fd, size, 06);
+    e = rf_mmapt(&ptr, b->fd, size, 06);
     if (e) {
-        (void) rf_close(fd);
-        (void) unlink(tmpfile);
-        free(tmpfile);
-        (void) rf_sigmask(NULL, 0, set);
+        (void) rf_close(b->fd);
+        (void) unlink(b->tmpfile);
+        free(b->tmpfile);
+        free(b);
         return e;
     }
+    b->data = (union clh2_cell *) ptr;
+    b->size = size;
+    b->count = count;
+    b->detached = 0;
+    builder_detach(b);
+    memset(&b->stats, 0, sizeof(b->stats));
+    b->stats.count = count;
+    b->stats.bytes = size;
+    b->stats.create_time = lap(&mark);
+    b->mark = mark;
+    b->usage = usage;
 
     /* set the magic number */
-    data = (union clh2_cell *) ptr;
-    data->indices = clh2_magic_in;
+    b->data->indices = *magic;
 
-    /* copy inputs (choose the faster way) */
-    if (cell_size == sizeof(*args)) {
-        (void) memcpy(data + 1, args, size - cell_size);
+    /* hand out the mapping directly if possible */
+    if (cell_size == sizeof(*b->args)) {
+        b->args = &b->data[1].indices;
     } else {
-        const struct clh2_indicesp *src = args;
-        union clh2_cell *dest = data + 1;
-        for (; src != args + count; ++dest, ++src)
+        b->args = (struct clh2_indicesp *)
+            malloc(count ? count * sizeof(*b->args) : 1);
+        if (!b->args) {
+            b->args = &b->data[1].indices;
+            builder_free(b);
+            return ENOMEM;
+        }
+    }
+
+    *builder = b;
+    return 0;
+}
+
+/* Runs the provider on the request and releases the builder.  The results
+   are stored in `*values` (to be freed using `clh2_free`) if `values` is not
+   `NULL`, or else copied into `out`. */
+static int builder_run(clh2_builder *b, const char *provider,
+                       const double **values, double *out) {
+    const char *argv[3] = {"clh2-am", NULL, NULL};
+    const size_t count = b->count, size = b->size;
+    const struct rusage usage = b->usage;
+    const int detached = b->detached;
+    struct clh2_stats stats;
+    struct rusage before, after;
+    struct rf_sigset set;
+    size_t new_size;
+    double mark;
+    int e, status;
+    void *ptr;
+
+    if (provider)
+        argv[0] = provider;
+    argv[1] = b->tmpfile;
+
+    /* copy inputs if they couldn't be written in place */
+    if (b->args != &b->data[1].indices) {
+        const struct clh2_indicesp *src = b->args;
+        union clh2_cell *dest = b->data + 1;
+        for (; src != b->args + count; ++dest, ++src)
             dest->indices = *src;
     }
 
-    /* flush data and close file */
-    (void) rf_munmap(ptr, size);
-    e = rf_close(fd);
+    /* flush data and close file, unless the provider needs the descriptor */
+    e = 0;
+    if (!detached) {
+        e = rf_close(b->fd);
+        b->fd = -1;
+    }
+    stats = b->stats;
+    stats.provider = provider;
+    mark = b->mark;
+    stats.write_time = lap(&mark);
     if (e) {
-        (void) unlink(tmpfile);
-        free(tmpfile);
-        (void) rf_sigmask(NULL, 0, set);
-        return e;
+        builder_free(b);
+        return report_stats(&stats, &usage, mark, e);
+    }
+
+    /* if the file still has a name, block all signals in this thread for
+       now; we rely on the child process to tell us when a signal has
+       occurred (since it is part of the same process group, it receives the
+       same signals from the terminal)
+
+       this is needed so we get a chance clean up the temporary file after a
+       signal (e.g. due to SIGINT from the user); otherwise we may end up with
+       a lot of abandoned temporary files
+
+       the mask only applies to this thread, so in a multithreaded program
+       the signal may still be delivered elsewhere; this is why the file is
+       unlinked beforehand whenever possible */
+    if (!detached) {
+        (void) rf_sigfillset(&set);
+        (void) rf_sigmask(&set, 0, set);
     }
 
     /* run child process */
+    if (getrusage(RUSAGE_CHILDREN, &before))
+        memset(&before, 0, sizeof(before));
     e = rf_spawn_wait(&status, argv);
+    stats.run_time = lap(&mark);
+    if (!e) {
+        stats.status = status;
+        if (!getrusage(RUSAGE_CHILDREN, &after)) {
+            stats.provider_minor_faults = after.ru_minflt - before.ru_minflt;
+            stats.provider_major_faults = after.ru_majflt - before.ru_majflt;
+        }
+    }
     if (!e && status) {
         if (status == 127)              /* due to spawn failure */
             e = ENOPROTOOPT;
@@ -115,38 +294,44 @@ int clh2_request(const double **values, const char *provider,
             e = ENOLINK;
     }
     if (e) {
-        (void) unlink(tmpfile);
-        free(tmpfile);
-        (void) rf_sigmask(NULL, 0, set);
-        return e;
+        builder_free(b);
+        if (!detached)
+            (void) rf_sigmask(NULL, 0, set);
+        return report_stats(&stats, &usage, mark, e);
     }
 
     /* memory map again (we can delete the file now) */
-    e = rf_mmapl(&ptr, &new_size, tmpfile, 04, 0);
-    (void) unlink(tmpfile);
-    free(tmpfile);
-    (void) rf_sigmask(NULL, 0, set);
+    e = detached ? rf_mmapf(&ptr, &new_size, b->fd, 04, 0) :
+                   rf_mmapl(&ptr, &new_size, b->tmpfile, 04, 0);
+    builder_free(b);
+    if (!detached)
+        (void) rf_sigmask(NULL, 0, set);
+    stats.map_time = lap(&mark);
     if (e)
-        return e;
+        return report_stats(&stats, &usage, mark, e);
 
     /* make sure the output is of the expected size */
     if (new_size != size) {
         (void) rf_munmap(ptr, new_size);
-        return EPROTO;
+        return report_stats(&stats, &usage, mark, EPROTO);
     }
 
     /* check if the representations are compatible */
-    if (cell_size == sizeof(**values)) {
+    if (cell_size == sizeof(double)) {
         const double *const data = (double *) ptr;
 
         /* check the magic number */
         if (*data != clh2_magic_out) {
             (void) rf_munmap(ptr, new_size);
-            return EPROTO;
+            return report_stats(&stats, &usage, mark, EPROTO);
         }
 
-        /* use it as is */
-        *values = data + 1;
+        /* use it as is (unless the caller has its own buffer) */
+        if (values) {
+            *values = data + 1;
+            return report_stats(&stats, &usage, mark, 0);
+        }
+        (void) memcpy(out, data + 1, count * sizeof(*out));
 
     } else {
         const union clh2_cell *const data = (union clh2_cell *) ptr;
@@ -156,31 +341,559 @@ int clh2_request(const double **values, const char *provider,
         /* check the magic number */
         if (data->value != clh2_magic_out) {
             (void) rf_munmap(ptr, new_size);
-            return EPROTO;
+            return report_stats(&stats, &usage, mark, EPROTO);
         }
 
         /* (safe to multiply since `double` is smaller than the union) */
-        dest = (double *) malloc(count * sizeof(**values));
-        if (!dest) {
-            (void) rf_munmap(ptr, new_size);
-            return ENOMEM;
+        if (values) {
+            out = (double *) malloc(count * sizeof(*out));
+            if (!out) {
+                (void) rf_munmap(ptr, new_size);
+                return report_stats(&stats, &usage, mark, ENOMEM);
+            }
+            *values = out;
         }
 
         /* copy the values */
-        *values = dest;
-        for (; dest != *values + count; ++dest, ++src)
+        for (dest = out; dest != out + count; ++dest, ++src)
             *dest = src->value;
-        (void) rf_munmap(ptr, new_size);
     }
+    (void) rf_munmap(ptr, new_size);
+    return report_stats(&stats, &usage, mark, 0);
+}
+
+/* Sends the request to the provider (bypassing the cache). */
+static int run_provider(const double **values, double *out,
+                        const char *provider, size_t count,
+                        const struct clh2_indicesp *args,
+                        enum clh2_kind kind) {
+    clh2_builder *b;
+    int e = builder_create(&b, count, kind);
+    if (e)
+        return e;
+    (void) memcpy(b->args, args, count * sizeof(*args));
+    return builder_run(b, provider, values, out);
+}
+
+/* Allocates an array of values in the same way as `run_provider` does, so
+   that it can be freed using `clh2_free`. */
+static int alloc_values(double **values, size_t count) {
+    size_t size;
+    rf_fd fd;
+    void *ptr;
+    int e;
+
+    if (cell_size != sizeof(**values)) {
+        if (rf_muls(&size, count, sizeof(**values)))
+            return ENOMEM;
+        *values = (double *) malloc(size);
+        return *values ? 0 : ENOMEM;
+    }
+
+    if (rf_adds(&size, count, 1) || rf_muls(&size, size, cell_size))
+        return ENOMEM;
+    e = rf_tmpfile(NULL, &fd, "clh2_val.");
+    if (e)
+        return e;
+    e = rf_mmapt(&ptr, fd, size, 06);
+    (void) rf_close(fd);
+    if (e)
+        return e;
+    *(double *) ptr = clh2_magic_out;
+    *values = (double *) ptr + 1;
+    return 0;
+}
+
+/* Computes the elements `args[todo[0]]`, ..., `args[todo[n - 1]]` and stores
+   them in `out`, publishing the ones that were claimed in the cache.  On
+   failure, the claims are abandoned so that other processes can retry. */
+static int compute_todo(clh2_cache *cache, double *out, const char *provider,
+                        const struct clh2_indicesp *args, enum clh2_kind kind,
+                        size_t *todo, size_t n, size_t *slots,
+                        unsigned char *status) {
+    clh2_builder *b;
+    const double *v;
+    size_t i;
+    int e;
+
+    if (!n)
+        return 0;
+    e = builder_create(&b, n, kind);
+    if (!e) {
+        for (i = 0; i != n; ++i)
+            b->args[i] = args[todo[i]];
+        e = builder_run(b, provider, &v, NULL);
+    }
+    for (i = 0; i != n; ++i) {
+        const size_t k = todo[i];
+        if (status[k] != CLH2_CACHE_CLAIMED)
+            continue;
+        if (e)
+            clh2_cache_abandon(cache, slots[k]);
+        else
+            clh2_cache_publish(cache, slots[k], v[i]);
+    }
+    if (e)
+        return e;
+    for (i = 0; i != n; ++i)
+        out[todo[i]] = v[i];
+    clh2_free(n, v);
     return 0;
 }
 
+/* Fulfills the request with the help of the node-wide cache: the elements
+   that nobody has claimed yet are computed first, and then the ones that
+   other processes are working on are collected (or computed here if the
+   other process goes away). */
+static int cached_request(clh2_cache *cache, double *out,
+                          const char *provider, size_t count,
+                          const struct clh2_indicesp *args,
+                          enum clh2_kind kind) {
+    unsigned char *status = NULL;
+    size_t *slots = NULL, *todo = NULL, i, n = 0;
+    int e = ENOMEM;
+
+    if (!rf_muls(&i, count, sizeof(*slots))) {
+        status = (unsigned char *) malloc(count);
+        slots = (size_t *) malloc(i);
+        todo = (size_t *) malloc(i);
+        if (status && slots && todo)
+            e = 0;
+    }
+
+    if (!e) {
+        for (i = 0; i != count; ++i) {
+            status[i] = (unsigned char)
+                clh2_cache_claim(cache, &slots[i], &out[i], kind, &args[i]);
+            if (status[i] == CLH2_CACHE_CLAIMED ||
+                status[i] == CLH2_CACHE_MISS)
+                todo[n++] = i;
+        }
+        e = compute_todo(cache, out, provider, args, kind,
+                         todo, n, slots, status);
+    }
+
+    if (!e) {
+        n = 0;
+        for (i = 0; i != count; ++i) {
+            if (status[i] != CLH2_CACHE_PENDING)
+                continue;
+            status[i] = (unsigned char)
+                clh2_cache_wait(cache, slots[i], &out[i]);
+            if (status[i] == CLH2_CACHE_CLAIMED)
+                todo[n++] = i;
+        }
+        e = compute_todo(cache, out, provider, args, kind,
+                         todo, n, slots, status);
+    }
+
+    free(status);
+    free(slots);
+    free(todo);
+    return e;
+}
+
+/* Fulfills the request using the cache, which is closed afterwards.  The
+   results are stored in `*values` if `values` is not `NULL`, or else in
+   `out`. */
+static int request_via_cache(clh2_cache *cache, const double **values,
+                             double *out, const char *provider, size_t count,
+                             const struct clh2_indicesp *args,
+                             enum clh2_kind kind) {
+    double *buf = out;
+    int e = values ? alloc_values(&buf, count) : 0;
+    if (!e)
+        e = cached_request(cache, buf, provider, count, args, kind);
+    clh2_cache_close(cache);
+    if (values) {
+        if (e)
+            clh2_free(count, buf);
+        else
+            *values = buf;
+    }
+    return e;
+}
+
+/* Requests of at most this many elements are coalesced; larger ones are
+   big enough to amortize the cost of running the provider on their own. */
+#define COALESCE_SMALL 4096
+
+/* The largest number of elements in a coalesced request. */
+#define COALESCE_CAPACITY 65536
+
+/* A provider run shared by several small requests from different threads.
+   The first thread to arrive (the leader) waits for the others until the
+   window closes or the batch fills up, then runs the provider on behalf of
+   all of them. */
+struct batch {
+    const char *provider;
+    enum clh2_kind kind;
+    struct clh2_indicesp *args;
+    double *values;
+    size_t count;
+
+    /* Number of threads that have yet to collect their results. */
+    size_t users;
+
+    int full, done, error;
+    pthread_cond_t cond;
+};
+
+/* Protects `open_batch` and the batches themselves. */
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The batch that is still accepting requests, if any. */
+static struct batch *open_batch;
+
+/* Reads the coalescing window in microseconds from `CLH2_COALESCE`.
+   Returns zero if coalescing is disabled. */
+static long coalesce_window(void) {
+    const char *s = getenv("CLH2_COALESCE");
+    char *end;
+    long w;
+    if (!s || !*s)
+        return 0;
+    w = strtol(s, &end, 10);
+    return *end || w < 0 ? 0 : w;
+}
+
+static int same_provider(const char *x, const char *y) {
+    return x == y || (x && y && !strcmp(x, y));
+}
+
+static struct batch *batch_create(const char *provider, enum clh2_kind kind) {
+    struct batch *b = (struct batch *) malloc(sizeof(*b));
+    if (!b)
+        return NULL;
+    b->args = (struct clh2_indicesp *)
+        malloc(COALESCE_CAPACITY * sizeof(*b->args));
+    if (!b->args || pthread_cond_init(&b->cond, NULL)) {
+        free(b->args);
+        free(b);
+        return NULL;
+    }
+    b->provider = provider;
+    b->kind = kind;
+    b->values = NULL;
+    b->count = 0;
+    b->users = 0;
+    b->full = 0;
+    b->done = 0;
+    b->error = 0;
+    return b;
+}
+
+static void batch_destroy(struct batch *b) {
+    (void) pthread_cond_destroy(&b->cond);
+    free(b->args);
+    free(b->values);
+    free(b);
+}
+
+/* Waits until the window closes or the batch fills up, then seals the batch
+   and runs the provider.  Must be called with the lock held. */
+static void batch_lead(struct batch *b, long window) {
+    struct timeval now;
+    struct timespec deadline;
+    double *values;
+    long usec;
+    int e;
+
+    (void) gettimeofday(&now, NULL);
+    usec = now.tv_usec + window % 1000000;
+    deadline.tv_sec = now.tv_sec + window / 1000000 + usec / 1000000;
+    deadline.tv_nsec = usec % 1000000 * 1000;
+    while (!b->full)
+        if (pthread_cond_timedwait(&b->cond, &batch_lock, &deadline))
+            break;
+    if (open_batch == b)
+        open_batch = NULL;
+    (void) pthread_mutex_unlock(&batch_lock);
+
+    values = (double *) malloc(b->count * sizeof(*values));
+    e = values ? run_provider(NULL, values, b->provider, b->count, b->args,
+                              b->kind) : ENOMEM;
+
+    (void) pthread_mutex_lock(&batch_lock);
+    b->values = values;
+    b->error = e;
+    b->done = 1;
+    (void) pthread_cond_broadcast(&b->cond);
+}
+
+/* Fulfills a small request by merging it with the requests that other
+   threads make within the window, so that the provider is run only once for
+   all of them.  The results are stored in `*values` if `values` is not
+   `NULL`, or else in `out`. */
+static int coalesced_request(const double **values, double *out,
+                             const char *provider, size_t count,
+                             const struct clh2_indicesp *args,
+                             enum clh2_kind kind, long window) {
+    struct batch *b;
+    size_t offset;
+    double *buf;
+    int e, last;
+
+    (void) pthread_mutex_lock(&batch_lock);
+    b = open_batch;
+    if (b && (!same_provider(b->provider, provider) || b->kind != kind ||
+              b->count + count > COALESCE_CAPACITY)) {
+        /* can't join, so just run it separately */
+        (void) pthread_mutex_unlock(&batch_lock);
+        return run_provider(values, out, provider, count, args, kind);
+    }
+    if (!b) {
+        b = batch_create(provider, kind);
+        if (!b) {
+            (void) pthread_mutex_unlock(&batch_lock);
+            return run_provider(values, out, provider, count, args, kind);
+        }
+        open_batch = b;
+    }
+    offset = b->count;
+    (void) memcpy(b->args + offset, args, count * sizeof(*args));
+    b->count += count;
+    ++b->users;
+
+    /* stop accepting requests once another one might not fit */
+    if (b->count + COALESCE_SMALL > COALESCE_CAPACITY) {
+        b->full = 1;
+        open_batch = NULL;
+        (void) pthread_cond_broadcast(&b->cond);
+    }
+    if (b->users == 1) {
+        batch_lead(b, window);
+    } else {
+        while (!b->done)
+            (void) pthread_cond_wait(&b->cond, &batch_lock);
+    }
+    (void) pthread_mutex_unlock(&batch_lock);
+
+    /* pick out our share of the results */
+    e = b->error;
+    if (!e) {
+        buf = out;
+        if (values)
+            e = alloc_values(&buf, count);
+        if (!e) {
+            (void) memcpy(buf, b->values + offset, count * sizeof(*buf));
+            if (values)
+                *values = buf;
+        }
+    }
+
+    (void) pthread_mutex_lock(&batch_lock);
+    last = !--b->users;
+    (void) pthread_mutex_unlock(&batch_lock);
+    if (last)
+        batch_destroy(b);
+    return e;
+}
+
+static int request(const double **values, double *out, const char *provider,
+                   size_t count, const struct clh2_indicesp *args,
+                   enum clh2_kind kind) {
+    clh2_cache *cache;
+    if (!count) {
+        if (values)
+            *values = NULL;
+        return 0;
+    }
+    cache = clh2_cache_open(provider);
+    if (!cache) {
+        const long window = coalesce_window();
+        if (window && count <= COALESCE_SMALL)
+            return coalesced_request(values, out, provider, count, args,
+                                     kind, window);
+        return run_provider(values, out, provider, count, args, kind);
+    }
+    return request_via_cache(cache, values, out, provider, count, args, kind);
+}
+
+int clh2_request(const double **values, const char *provider,
+                 size_t count, const struct clh2_indicesp *args) {
+    if (!values || (count && !args))
+        return EINVAL;
+    return request(values, NULL, provider, count, args, CLH2_KIND_PLAIN);
+}
+
+int clh2_request_antisym(const double **values, const char *provider,
+                         size_t count, const struct clh2_indicesp *args) {
+    if (!values || (count && !args))
+        return EINVAL;
+    return request(values, NULL, provider, count, args, CLH2_KIND_ANTISYM);
+}
+
+int clh2_request_into(double *values, const char *provider,
+                      size_t count, const struct clh2_indicesp *args) {
+    if (count && (!values || !args))
+        return EINVAL;
+    return request(NULL, values, provider, count, args, CLH2_KIND_PLAIN);
+}
+
+/* Stops handing out a separate array of indices, for requests whose cells
+   are filled in some other way. */
+static void builder_use_cells(clh2_builder *b) {
+    if (b->args != &b->data[1].indices) {
+        free(b->args);
+        b->args = &b->data[1].indices;
+    }
+}
+
+int clh2_request_spec(const double **values, const char *provider,
+                      const struct clh2_spec *spec) {
+    const enum clh2_kind kind =
+        spec && spec->antisym ? CLH2_KIND_ANTISYM : CLH2_KIND_PLAIN;
+    struct clh2_indicesp *args;
+    clh2_cache *cache;
+    clh2_builder *b;
+    size_t count;
+    int e;
+
+    if (!values || !spec)
+        return EINVAL;
+    e = clh2_spec_enumerate(&count, NULL, spec);
+    if (e)
+        return e;
+    if (!count) {
+        *values = NULL;
+        return 0;
+    }
+
+    /* the cache needs to know the indices */
+    cache = clh2_cache_open(provider);
+    if (cache) {
+        size_t size;
+        args = NULL;
+        if (!rf_muls(&size, count, sizeof(*args)))
+            args = (struct clh2_indicesp *) malloc(size);
+        if (!args) {
+            clh2_cache_close(cache);
+            return ENOMEM;
+        }
+        (void) clh2_spec_enumerate(&count, args, spec);
+        e = request_via_cache(cache, values, NULL, provider, count, args,
+                              kind);
+        free(args);
+        return e;
+    }
+
+    /* otherwise, only the specification is written */
+    e = builder_create(&b, count, kind);
+    if (e)
+        return e;
+    builder_use_cells(b);
+    b->data->indices = clh2_magic_in_spec;
+    b->data[1].spec = *spec;
+    return builder_run(b, provider, values, NULL);
+}
+
+int clh2_request_fock(double *fock, const char *provider,
+                      const struct clh2_spec *spec, const double *density) {
+    clh2_builder *b;
+    const double *v;
+    size_t n, count, i;
+    int e;
+
+    if (!spec || spec->min_shells)
+        return EINVAL;
+    e = clh2_spec_orbitals(&n, NULL, spec);
+    if (e)
+        return e;
+    if (!n)
+        return 0;
+    if (!fock || !density)
+        return EINVAL;
+
+    /* one cell for the specification, followed by the density matrix */
+    if (rf_muls(&count, n, n) || rf_adds(&count, count, 1))
+        return ENOMEM;
+    e = builder_create(&b, count, CLH2_KIND_PLAIN);
+    if (e)
+        return e;
+    builder_use_cells(b);
+    b->data->indices = clh2_magic_in_fock;
+    b->data[1].spec = *spec;
+    for (i = 0; i != count - 1; ++i)
+        b->data[i + 2].value = density[i];
+
+    e = builder_run(b, provider, &v, NULL);
+    if (e)
+        return e;
+    (void) memcpy(fock, v, (count - 1) * sizeof(*fock));
+    clh2_free(count, v);
+    return 0;
+}
+
+int clh2_builder_create(clh2_builder **builder, struct clh2_indicesp **args,
+                        size_t count) {
+    int e;
+    if (!builder || !args)
+        return EINVAL;
+    e = builder_create(builder, count, CLH2_KIND_PLAIN);
+    if (!e)
+        *args = (*builder)->args;
+    return e;
+}
+
+void clh2_builder_destroy(clh2_builder *builder) {
+    if (builder)
+        builder_free(builder);
+}
+
+/* Runs the builder's request, going through the cache if enabled. */
+static int builder_request(clh2_builder *builder, const double **values,
+                           double *out, const char *provider) {
+    clh2_cache *cache;
+    int e;
+
+    if (!builder->count) {
+        builder_free(builder);
+        if (values)
+            *values = NULL;
+        return 0;
+    }
+
+    cache = clh2_cache_open(provider);
+    if (!cache)
+        return builder_run(builder, provider, values, out);
+
+    /* the request file is only used for its indices in this case */
+    e = request_via_cache(cache, values, out, provider, builder->count,
+                          builder->args, CLH2_KIND_PLAIN);
+    builder_free(builder);
+    return e;
+}
+
+int clh2_builder_request(clh2_builder *builder, const double **values,
+                         const char *provider) {
+    if (!builder)
+        return EINVAL;
+    if (!values) {
+        builder_free(builder);
+        return EINVAL;
+    }
+    return builder_request(builder, values, NULL, provider);
+}
+
+int clh2_builder_request_into(clh2_builder *builder, double *values,
+                              const char *provider) {
+    if (!builder)
+        return EINVAL;
+    if (builder->count && !values) {
+        builder_free(builder);
+        return EINVAL;
+    }
+    return builder_request(builder, NULL, values, provider);
+}
+
 void clh2_free(size_t count, const double *values) {
     /* release the memory based on how it was allocated previously */
     if (cell_size == sizeof(*values)) {
         const size_t size = (count + 1) * sizeof(*values);
-        /* this handles `values == NULL` just fine */
-        (void) rf_munmap((void *) values, size);
+        /* the mapping starts with the magic number, right before the values;
+           `rf_munmap` handles `NULL` just fine */
+        (void) rf_munmap(values ? (void *) (values - 1) : NULL, size);
     } else {
         free((double *) values);
     }
@@ -0,0 +1,289 @@
+/*
+
+compares the accuracy and throughput of several providers:
+
+    compare [--json] [--ref PROVIDER] [--threshold ERROR]
+            NUM_SHELLS PROVIDER...
+
+the basis is grown one shell at a time, and at each step only the elements
+that involve the new shell are requested from every provider (so each
+element is requested once); the time taken includes the request protocol,
+and the errors are relative to the reference provider (`clh2-tm` by
+default, the most accurate of the bundled ones)
+
+for each provider and number of shells, the throughput as well as the
+maximum and RMS relative errors are reported, followed by the first number
+of shells at which the maximum error exceeds the threshold
+
+*/
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <clh2.h>
+
+/* chosen to keep the requests reasonably sized */
+#define NUM_SHELLS_MAX 40
+
+/* reference values smaller than this are compared in absolute terms, since
+   many elements vanish by symmetry */
+#define ERROR_FLOOR 1e-10
+
+struct result {
+    size_t count;
+    double seconds, max_error, rms_error;
+
+    /* nonzero if the provider failed (or an earlier step did) */
+    int error;
+};
+
+static double wall_time(void) {
+    struct timeval tv;
+    (void) gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec + 1e-6 * (double) tv.tv_usec;
+}
+
+/* Requests the elements of a specification, falling back to a list of
+   indices for providers that don't understand specifications. */
+static int request(const double **values, double *seconds,
+                   const char *provider, const struct clh2_spec *spec) {
+    const double start = wall_time();
+    int e = clh2_request_spec(values, provider, spec);
+    if (e == EPROTO) {
+        struct clh2_indicesp *args;
+        size_t count;
+        e = clh2_spec_enumerate(&count, NULL, spec);
+        if (e)
+            return e;
+        args = (struct clh2_indicesp *) malloc(count * sizeof(*args));
+        if (!args)
+            return ENOMEM;
+        (void) clh2_spec_enumerate(&count, args, spec);
+        e = clh2_request(values, provider, count, args);
+        free(args);
+    }
+    *seconds = wall_time() - start;
+    return e;
+}
+
+static void compare(struct result *r, const double *zs, const double *ws) {
+    double sum = 0;
+    size_t i;
+    r->max_error = 0;
+    for (i = 0; i != r->count; ++i) {
+        const double w = fabs(ws[i]) > ERROR_FLOOR ? fabs(ws[i]) : ERROR_FLOOR;
+        const double err = fabs(zs[i] - ws[i]) / w;
+        if (err > r->max_error)
+            r->max_error = err;
+        sum += err * err;
+    }
+    r->rms_error = r->count ? sqrt(sum / (double) r->count) : 0;
+}
+
+/* Returns the first number of shells at which the error exceeds the
+   threshold, or zero if there is none. */
+static int first_above(const struct result *rs, int num_shells,
+                       double threshold) {
+    int k;
+    for (k = 0; k != num_shells; ++k)
+        if (!rs[k].error && rs[k].max_error > threshold)
+            return k + 1;
+    return 0;
+}
+
+static void print_json_string(const char *s) {
+    putchar('"');
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\')
+            putchar('\\');
+        putchar(*s);
+    }
+    putchar('"');
+}
+
+/* JSON has no infinities or NaNs (e.g. from a request that took no
+   measurable time), so they are written as `null`. */
+static void print_json_number(double x) {
+    if (x - x == 0)
+        printf("%g", x);
+    else
+        printf("null");
+}
+
+static void print_json(const char *ref, double threshold, int num_shells,
+                       const char *const *providers, int num_providers,
+                       const struct result *results) {
+    int i, k;
+    printf("{\n  \"reference\": ");
+    print_json_string(ref);
+    printf(",\n  \"threshold\": ");
+    print_json_number(threshold);
+    printf(",\n  \"providers\": [");
+    for (i = 0; i != num_providers; ++i) {
+        const struct result *rs = results + i * num_shells;
+        const int above = first_above(rs, num_shells, threshold);
+        printf("%s\n    {\n      \"provider\": ", i ? "," : "");
+        print_json_string(providers[i]);
+        if (above)
+            printf(",\n      \"first_shells_above_threshold\": %d", above);
+        else
+            printf(",\n      \"first_shells_above_threshold\": null");
+        printf(",\n      \"sweep\": [");
+        for (k = 0; k != num_shells && !rs[k].error; ++k) {
+            printf("%s\n        {\"num_shells\": %d, \"count\": %lu, "
+                   "\"seconds\": ", k ? "," : "", k + 1,
+                   (unsigned long) rs[k].count);
+            print_json_number(rs[k].seconds);
+            printf(", \"elements_per_second\": ");
+            print_json_number((double) rs[k].count / rs[k].seconds);
+            printf(", \"max_rel_error\": ");
+            print_json_number(rs[k].max_error);
+            printf(", \"rms_rel_error\": ");
+            print_json_number(rs[k].rms_error);
+            printf("}");
+        }
+        printf("\n      ]\n    }");
+    }
+    printf("\n  ]\n}\n");
+}
+
+static void print_table(const char *ref, double threshold, int num_shells,
+                        const char *const *providers, int num_providers,
+                        const struct result *results) {
+    int i, k;
+    printf("# reference: %s\n"
+           "# %6s %-20s %10s %10s %12s %10s %10s\n", ref, "shells",
+           "provider", "count", "seconds", "elements/s", "max_rel",
+           "rms_rel");
+    for (k = 0; k != num_shells; ++k)
+        for (i = 0; i != num_providers; ++i) {
+            const struct result *r = results + i * num_shells + k;
+            if (r->error)
+                continue;
+            printf("  %6d %-20s %10lu %10.4f %12.4g %10.2e %10.2e\n",
+                   k + 1, providers[i], (unsigned long) r->count,
+                   r->seconds, (double) r->count / r->seconds,
+                   r->max_error, r->rms_error);
+        }
+    printf("#\n# first number of shells with max_rel > %g:\n", threshold);
+    for (i = 0; i != num_providers; ++i) {
+        const int above =
+            first_above(results + i * num_shells, num_shells, threshold);
+        if (above)
+            printf("#   %-20s %d\n", providers[i], above);
+        else
+            printf("#   %-20s none\n", providers[i]);
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *ref = "clh2-tm";
+    const char *const *providers;
+    struct result *results;
+    double threshold = 1e-6;
+    int json = 0, num_shells, num_providers, i, k;
+    char *end;
+    long n;
+
+    for (; argc > 1 && !strncmp(argv[1], "--", 2); --argc, ++argv) {
+        if (!strcmp(argv[1], "--json")) {
+            json = 1;
+        } else if (argc > 2 && !strcmp(argv[1], "--ref")) {
+            ref = argv[2];
+            --argc;
+            ++argv;
+        } else if (argc > 2 && !strcmp(argv[1], "--threshold")) {
+            threshold = strtod(argv[2], &end);
+            if (argv[2] == end || *end || !(threshold >= 0)) {
+                fprintf(stderr, "compare: invalid threshold: %s\n", argv[2]);
+                return EXIT_FAILURE;
+            }
+            --argc;
+            ++argv;
+        } else {
+            argc = 0;
+            break;
+        }
+    }
+    if (argc < 3) {
+        fprintf(stderr, "Usage: compare [--json] [--ref PROVIDER]"
+                        " [--threshold ERROR] NUM_SHELLS PROVIDER...\n"
+                        "  where NUM_SHELLS is the largest number of shells\n"
+                        "    and PROVIDER   is a tabulation provider\n"
+                        "    and ERROR      is the largest acceptable"
+                        " relative error (default: 1e-6)\n");
+        return EXIT_FAILURE;
+    }
+    n = strtol(argv[1], &end, 10);
+    if (argv[1] == end || *end || n < 1 || n > NUM_SHELLS_MAX) {
+        fprintf(stderr, "compare: NUM_SHELLS must be between 1 and %d: %s\n",
+                NUM_SHELLS_MAX, argv[1]);
+        return EXIT_FAILURE;
+    }
+    num_shells = (int) n;
+    providers = (const char *const *) argv + 2;
+    num_providers = argc - 2;
+    if (getenv("CLH2_CACHE"))
+        fprintf(stderr, "compare: warning: CLH2_CACHE is set, so the"
+                        " timings are not meaningful\n");
+
+    results = (struct result *) calloc((size_t) (num_providers * num_shells),
+                                       sizeof(*results));
+    if (!results) {
+        fprintf(stderr, "compare: %s\n", strerror(ENOMEM));
+        return EXIT_FAILURE;
+    }
+
+    for (k = 0; k != num_shells; ++k) {
+        struct clh2_spec spec;
+        const double *ws;
+        double seconds;
+        size_t count;
+        int e;
+
+        memset(&spec, 0, sizeof(spec));
+        spec.num_shells = (unsigned char) (k + 1);
+        spec.min_shells = (unsigned char) k;
+        (void) clh2_spec_enumerate(&count, NULL, &spec);
+        e = request(&ws, &seconds, ref, &spec);
+        if (e) {
+            fprintf(stderr, "compare: %s: %s\n", ref, strerror(e));
+            free(results);
+            return EXIT_FAILURE;
+        }
+
+        for (i = 0; i != num_providers; ++i) {
+            struct result *r = results + i * num_shells + k;
+            const double *zs;
+            r->count = count;
+            if (k && r[-1].error) {
+                r->error = r[-1].error;
+                continue;
+            }
+            if (!strcmp(providers[i], ref)) {
+                r->seconds = seconds;
+                continue;
+            }
+            r->error = request(&zs, &r->seconds, providers[i], &spec);
+            if (r->error) {
+                fprintf(stderr, "compare: %s: %s\n", providers[i],
+                        strerror(r->error));
+                continue;
+            }
+            compare(r, zs, ws);
+            clh2_free(count, zs);
+        }
+        clh2_free(count, ws);
+    }
+
+    if (json)
+        print_json(ref, threshold, num_shells, providers, num_providers,
+                   results);
+    else
+        print_table(ref, threshold, num_shells, providers, num_providers,
+                    results);
+    free(results);
+    return EXIT_SUCCESS;
+}
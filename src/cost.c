@@ -0,0 +1,42 @@
+#include <stdlib.h>
+#include <clh2.h>
+#ifdef HAVE_AM_COEFFS
+# include "am-coeffs.h"
+#endif
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Counts the iterations of the `s`-loop in `clh2_element` for given `g1` and
+   `g2`, which runs over `[0, g1 + g2]`.  If the inner sums were tabulated at
+   build time (up to `g1 + g2 = AM_COEFF_N_MAX`), each is a single lookup. */
+static double inner_cost(unsigned g1, unsigned g2, int exact) {
+    return exact ? 1 : (double) (g1 + g2 + 1);
+}
+
+double clh2_element_cost(const struct clh2_indicesp *ix) {
+    /* relabeled in the same way as `clh2_element` */
+    const unsigned n1 = ix->n1, n2 = ix->n2, n3 = ix->n4, n4 = ix->n3;
+    const int m1 = ix->ml1, m2 = ix->ml2, m3 = ix->ml4, m4 = ix->ml3;
+    const int M1 = abs(m1), M2 = abs(m2), M3 = abs(m3), M4 = abs(m4);
+    unsigned k1, k2, a, b;
+    double cost = 0;
+    int exact = 0;
+    if (m1 + m2 != m3 + m4)
+        return 0;
+    k1 = (unsigned) (M1 + m1 + M4 - m4) / 2;
+    k2 = (unsigned) (M2 + m2 + M3 - m3) / 2;
+#ifdef HAVE_AM_COEFFS
+    exact = n1 + n2 + n3 + n4 + (unsigned) (M1 + M2 + M3 + M4) / 2
+         <= AM_COEFF_N_MAX;
+#endif
+    /* the terms are grouped by `j1 + j4` and `j2 + j3` */
+    for (a = 0; a <= n1 + n4; ++a)
+    for (b = 0; b <= n2 + n3; ++b)
+        cost += inner_cost(a + k1, b + k2, exact);
+    return cost;
+}
+
+#ifdef __cplusplus
+}
+#endif
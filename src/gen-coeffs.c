@@ -0,0 +1,264 @@
+/*
+
+generates exact tables of the inner sums in `clh2_element`:
+
+    gen-coeffs N_MAX >am-coeffs.inc
+
+since `k1 + k2 = M / 2`, the inner sum of `am_pair_term` depends only on
+`g1` to `g4`, where `n = g1 + g2 = g3 + g4` and `G1 = 2 n + 1`; apart from a
+common factor of `√(π / 2)` and the sign `(-1)^(A + B)`, it is equal to
+
+    4^(-n) Σ[s] P(g2, g1, s) P(g3, g4, s) s! (2 n - 2 s - 1)!! 2^s
+
+where `P(a, b, s)` is the coefficient of `x^s` in `(1 + x)^a (1 - x)^b`;
+the sum is an integer, so it is evaluated exactly using arbitrary-precision
+arithmetic and then rounded correctly to the nearest `double`
+
+the values are emitted as the table `am_coeffs` for every `n <= N_MAX`,
+indexed by `n (n + 1) (2 n + 1) / 6 + g1 (n + 1) + g3`; every matrix
+element within `K` shells is covered by `N_MAX = 2 K - 2`; `N_MAX` itself
+is not emitted, since the build defines `AM_COEFF_N_MAX` in `am-coeffs.h`
+(which is also used by `cost.c`), and the table refuses to compile if the two
+disagree
+
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* chosen to keep the size of the table reasonable */
+#define N_MAX_MAX 120
+
+/* Integers are stored in sign-magnitude form with 16-bit limbs (least
+   significant first), so that the product of two limbs plus a carry always
+   fits in an `unsigned long`.  The capacity suffices for `N_MAX_MAX`. */
+#define LIMB_BITS 16
+#define LIMB_MASK 0xffffUL
+#define LIMBS 192
+
+struct big {
+    int neg;
+    size_t len;
+    unsigned long d[LIMBS];
+};
+
+static void overflow(void) {
+    fprintf(stderr, "gen-coeffs: integer overflow\n");
+    exit(EXIT_FAILURE);
+}
+
+/* Removes the leading zero limbs. */
+static void trim(struct big *x) {
+    while (x->len && !x->d[x->len - 1])
+        --x->len;
+    if (!x->len)
+        x->neg = 0;
+}
+
+static void big_set(struct big *x, unsigned long v) {
+    x->neg = 0;
+    x->len = 0;
+    for (; v; v >>= LIMB_BITS)
+        x->d[x->len++] = v & LIMB_MASK;
+}
+
+/* Multiplies by a number below `2^LIMB_BITS`. */
+static void big_mul_small(struct big *x, unsigned long m) {
+    unsigned long carry = 0;
+    size_t i;
+    for (i = 0; i != x->len; ++i) {
+        carry += x->d[i] * m;
+        x->d[i] = carry & LIMB_MASK;
+        carry >>= LIMB_BITS;
+    }
+    for (; carry; carry >>= LIMB_BITS) {
+        if (x->len == LIMBS)
+            overflow();
+        x->d[x->len++] = carry & LIMB_MASK;
+    }
+    trim(x);
+}
+
+/* Calculates `z = x y`.  The arguments must not overlap with `z`. */
+static void big_mul(struct big *z, const struct big *x, const struct big *y) {
+    size_t i, j;
+    if (x->len + y->len > LIMBS)
+        overflow();
+    z->neg = x->neg != y->neg;
+    z->len = x->len + y->len;
+    memset(z->d, 0, z->len * sizeof(*z->d));
+    for (i = 0; i != x->len; ++i) {
+        unsigned long carry = 0;
+        for (j = 0; j != y->len; ++j) {
+            carry += z->d[i + j] + x->d[i] * y->d[j];
+            z->d[i + j] = carry & LIMB_MASK;
+            carry >>= LIMB_BITS;
+        }
+        z->d[i + y->len] = carry;
+    }
+    trim(z);
+}
+
+/* Compares the magnitudes. */
+static int mag_cmp(const struct big *x, const struct big *y) {
+    size_t i;
+    if (x->len != y->len)
+        return x->len < y->len ? -1 : 1;
+    for (i = x->len; i-- > 0;)
+        if (x->d[i] != y->d[i])
+            return x->d[i] < y->d[i] ? -1 : 1;
+    return 0;
+}
+
+/* Calculates `x += y` (or `x -= y` if `negate` is nonzero). */
+static void big_add(struct big *x, const struct big *y, int negate) {
+    const int y_neg = negate ? !y->neg : y->neg;
+    size_t i;
+    if (!y->len)
+        return;
+    if (!x->len || x->neg == y_neg) {
+        unsigned long carry = 0;
+        const size_t len = x->len > y->len ? x->len : y->len;
+        if (!x->len)
+            x->neg = y_neg;
+        for (i = 0; i != len; ++i) {
+            carry += (i < x->len ? x->d[i] : 0) + (i < y->len ? y->d[i] : 0);
+            x->d[i] = carry & LIMB_MASK;
+            carry >>= LIMB_BITS;
+        }
+        x->len = len;
+        if (carry) {
+            if (x->len == LIMBS)
+                overflow();
+            x->d[x->len++] = carry;
+        }
+    } else {
+        /* subtract the smaller magnitude from the larger one */
+        const int swap = mag_cmp(x, y) < 0;
+        const struct big *big = swap ? y : x, *small = swap ? x : y;
+        unsigned long borrow = 0;
+        struct big r;
+        r.neg = swap ? y_neg : x->neg;
+        r.len = big->len;
+        for (i = 0; i != big->len; ++i) {
+            const unsigned long t = (i < small->len ? small->d[i] : 0)
+                                  + borrow;
+            borrow = big->d[i] < t;
+            r.d[i] = (big->d[i] + (borrow << LIMB_BITS) - t) & LIMB_MASK;
+        }
+        *x = r;
+    }
+    trim(x);
+}
+
+static int bit(const struct big *x, size_t i) {
+    return (int) ((x->d[i / LIMB_BITS] >> (i % LIMB_BITS)) & 1);
+}
+
+/* Rounds to the nearest `double` (ties to even). */
+static double big_to_double(const struct big *x) {
+    size_t bits, i;
+    unsigned long top;
+    double m = 0;
+    if (!x->len)
+        return 0;
+    bits = (x->len - 1) * LIMB_BITS;
+    for (top = x->d[x->len - 1]; top; top >>= 1)
+        ++bits;
+    if (bits <= 53) {
+        for (i = bits; i-- > 0;)
+            m = 2 * m + bit(x, i);
+    } else {
+        int odd = 0, half, sticky = 0;
+        for (i = bits; i-- > bits - 53;)
+            m = 2 * m + (odd = bit(x, i));
+        half = bit(x, bits - 54);
+        for (i = 0; i != bits - 54 && !sticky; ++i)
+            sticky = bit(x, i);
+        if (half && (sticky || odd))
+            m += 1;
+        m = ldexp(m, (int) (bits - 53));
+    }
+    return x->neg ? -m : m;
+}
+
+int main(int argc, char **argv) {
+    struct big *rows, *factors, term, product;
+    unsigned n_max, n, a, s, g1, g3, k;
+    char *end;
+    long arg;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: gen-coeffs N_MAX\n"
+                        "  where N_MAX is the largest g1 + g2 to be"
+                        " tabulated\n");
+        return EXIT_FAILURE;
+    }
+    arg = strtol(argv[1], &end, 10);
+    if (argv[1] == end || *end || arg < 0 || arg > N_MAX_MAX) {
+        fprintf(stderr, "gen-coeffs: N_MAX must be between 0 and %d: %s\n",
+                N_MAX_MAX, argv[1]);
+        return EXIT_FAILURE;
+    }
+    n_max = (unsigned) arg;
+
+    /* rows[a * (n + 1) + s] = P(a, n - a, s) for the current n */
+    rows = (struct big *) malloc((n_max + 1) * (n_max + 1) * sizeof(*rows));
+    factors = (struct big *) malloc((n_max + 1) * sizeof(*factors));
+    if (!rows || !factors) {
+        fprintf(stderr, "gen-coeffs: can't allocate memory\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("/* Generated by gen-coeffs.  Do not edit. */\n"
+           "#if AM_COEFF_N_MAX != %u\n"
+           "# error \"am-coeffs.inc does not match AM_COEFF_N_MAX\"\n"
+           "#endif\n\n"
+           "static const double am_coeffs[] = {\n", n_max);
+    for (n = 0; n <= n_max; ++n) {
+
+        /* expand (1 + x)^a (1 - x)^(n - a) one factor at a time */
+        for (a = 0; a <= n; ++a) {
+            struct big *row = rows + a * (n + 1);
+            unsigned deg;
+            big_set(&row[0], 1);
+            for (deg = 1; deg <= n; ++deg) {
+                const int minus = deg > a;
+                big_set(&row[deg], 0);
+                for (s = deg; s > 0; --s)
+                    big_add(&row[s], &row[s - 1], minus);
+            }
+        }
+
+        /* s! (2 n - 2 s - 1)!! 2^s */
+        for (s = 0; s <= n; ++s) {
+            big_set(&factors[s], 1);
+            for (k = 2; k <= s; ++k)
+                big_mul_small(&factors[s], k);
+            for (k = 2 * (n - s); k > 1; k -= 2)
+                big_mul_small(&factors[s], k - 1);
+            for (k = 0; k != s; ++k)
+                big_mul_small(&factors[s], 2);
+        }
+
+        for (g1 = 0; g1 <= n; ++g1)
+        for (g3 = 0; g3 <= n; ++g3) {
+            const struct big *p12 = rows + (n - g1) * (n + 1);
+            const struct big *p34 = rows + g3 * (n + 1);
+            struct big sum;
+            big_set(&sum, 0);
+            for (s = 0; s <= n; ++s) {
+                big_mul(&product, &p12[s], &p34[s]);
+                big_mul(&term, &product, &factors[s]);
+                big_add(&sum, &term, 0);
+            }
+            printf("    %.17g,\n", ldexp(big_to_double(&sum), -2 * (int) n));
+        }
+    }
+    printf("};\n");
+
+    free(rows);
+    free(factors);
+    return fflush(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+/*
+
+generates fully unrolled versions of the outer sums in `clh2_element`:
+
+    gen-kernels N_MAX >am-kernels.inc
+
+for every combination of principal quantum numbers `n1` to `n4` that do not
+exceed `N_MAX`, a kernel is emitted that evaluates the contraction in
+`am_paired`, calling `am_pair_term` once for each `(A, B)` and summing in the
+same order, so the result is identical to that of the generic path (just
+without the loop control)
+
+the kernels are collected into a lookup table `am_kernels`, indexed by
+`((n1 * (N_MAX + 1) + n2) * (N_MAX + 1) + n3) * (N_MAX + 1) + n4`
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+
+/* chosen to keep the size of the generated code reasonable */
+#define N_MAX_MAX 4
+
+/* Prints `x = pre<p>[0] * pre<q>[k] + ...`, summed over every `j <= n` and
+   `k <= m` such that `j + k = c`, in the same order as in `am_paired`. */
+static void print_pair_sum(const char *x, unsigned c,
+                           unsigned p, unsigned n, unsigned q, unsigned m) {
+    unsigned j;
+    const char *sep = "";
+    printf("    %s =", x);
+    for (j = c > m ? c - m : 0; j <= c && j <= n; ++j) {
+        printf("%s a->pre%u[%u] * a->pre%u[%u]", sep, p, j, q, c - j);
+        sep = "\n        +";
+    }
+    printf(";\n");
+}
+
+static void print_kernel(unsigned n1, unsigned n2, unsigned n3, unsigned n4) {
+    unsigned A, B;
+    char name[16];
+    printf("static double am_kernel_%u_%u_%u_%u"
+           "(const clh2_ctx *ctx, const struct am_args *a) {\n"
+           "    double r = 0, u, row, v[%u];\n",
+           n1, n2, n3, n4, n2 + n3 + 1);
+    for (B = 0; B <= n2 + n3; ++B) {
+        sprintf(name, "v[%u]", B);
+        print_pair_sum(name, B, 2, n2, 3, n3);
+    }
+    for (A = 0; A <= n1 + n4; ++A) {
+        print_pair_sum("u", A, 1, n1, 4, n4);
+        printf("    row = 0;\n");
+        for (B = 0; B <= n2 + n3; ++B)
+            printf("    row += v[%u] * am_pair_term(ctx, a, %u, %u);\n",
+                   B, A, B);
+        printf("    r += u * row;\n");
+    }
+    printf("    return r;\n"
+           "}\n\n");
+}
+
+int main(int argc, char **argv) {
+    unsigned n_max, n1, n2, n3, n4;
+    char *end;
+    long n;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: gen-kernels N_MAX\n"
+                        "  where N_MAX is the largest principal quantum number"
+                        " to be unrolled\n");
+        return EXIT_FAILURE;
+    }
+    n = strtol(argv[1], &end, 10);
+    if (argv[1] == end || *end || n < 0 || n > N_MAX_MAX) {
+        fprintf(stderr, "gen-kernels: N_MAX must be between 0 and %d: %s\n",
+                N_MAX_MAX, argv[1]);
+        return EXIT_FAILURE;
+    }
+    n_max = (unsigned) n;
+
+    printf("/* Generated by gen-kernels.  Do not edit. */\n"
+           "#define AM_KERNEL_N_MAX %u\n\n", n_max);
+    for (n1 = 0; n1 <= n_max; ++n1)
+    for (n2 = 0; n2 <= n_max; ++n2)
+    for (n3 = 0; n3 <= n_max; ++n3)
+    for (n4 = 0; n4 <= n_max; ++n4)
+        print_kernel(n1, n2, n3, n4);
+
+    printf("static double (*const am_kernels[])"
+           "(const clh2_ctx *, const struct am_args *) = {\n");
+    for (n1 = 0; n1 <= n_max; ++n1)
+    for (n2 = 0; n2 <= n_max; ++n2)
+    for (n3 = 0; n3 <= n_max; ++n3)
+    for (n4 = 0; n4 <= n_max; ++n4)
+        printf("    am_kernel_%u_%u_%u_%u,\n", n1, n2, n3, n4);
+    printf("};\n");
+
+    return fflush(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,248 @@
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "gl.h"
+#ifndef NAN
+# define NAN (0./0.)
+#endif
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The method: in momentum space the Coulomb interaction is `2π / k`, so
+
+       <1 2|V|3 4> = ∫ d²k / (2π k) <1|exp(i k r)|3> <2|exp(-i k r)|4>
+
+   Expressed in terms of the circular quanta of the oscillator, the operator
+   `exp(i k r)` is a product of two displacement operators, whose matrix
+   elements are the oscillator orbitals `φ[n, ml]` evaluated at `|k| / 2`.
+   After the angular integration (which enforces the conservation of `ml`),
+   the substitution `u = k² / 2` turns the remaining integral into
+
+       ∫ du u^(-1/2) exp(-u) P(u)
+
+   where `P` is a polynomial, which is integrated exactly by Gauss-Laguerre
+   quadrature with enough nodes.  Each matrix element then becomes a dot
+   product of four orbitals and the weights over the nodes. */
+
+/* Number of independent partial sums in the dot product. */
+#define LANES 4
+
+/* A structure used to store the nodes and the orbital values. */
+struct clh2_gl_ctx {
+    /* number of nodes requested by the user (zero means automatic) */
+    size_t  fixed_nodes;
+    /* number of nodes and the size of each row (padded to `LANES`) */
+    size_t  nodes;
+    size_t  stride;
+    /* weights, scaled by `exp(u) / √2` and padded with zeros */
+    double *weight;
+    /* orbital values for `n, |ml| <= e_max` at each node */
+    double *orbital;
+    size_t  e_max;
+};
+
+/* Calculates `(-1) ^ n`. */
+static int minuspow(size_t n) { return (n % 2) ? -1 : 1; }
+
+/* Calculates the Gauss-Laguerre nodes and scaled weights `w exp(u)` for the
+   weight function `u^alpha exp(-u)` using Newton's method.  Returns nonzero if
+   the iteration fails to converge. */
+static int gauss_laguerre(double *u, double *w, size_t n, double alpha) {
+    static const double eps = 3e-14;
+    static const int max_iter = 100;
+    const double dn = (double) n;
+    size_t i, j;
+    double z = 0;
+    for (i = 0; i != n; ++i) {
+        double p1 = 1, p2 = 0, pp = 0;
+        int iter;
+        /* initial guesses for the roots */
+        if (i == 0) {
+            z = (1 + alpha) * (3 + .92 * alpha) / (1 + 2.4 * dn + 1.8 * alpha);
+        } else if (i == 1) {
+            z += (15 + 6.25 * alpha) / (1 + .9 * alpha + 2.5 * dn);
+        } else {
+            const double ai = (double) (i - 1);
+            z += ((1 + 2.55 * ai) / (1.9 * ai) + 1.26 * ai * alpha
+                  / (1 + 3.5 * ai)) * (z - u[i - 2]) / (1 + .3 * alpha);
+        }
+        /* refine using Newton's method */
+        for (iter = 0; iter != max_iter; ++iter) {
+            double z1 = z;
+            p1 = 1;
+            p2 = 0;
+            for (j = 1; j <= n; ++j) {
+                const double dj = (double) j, p3 = p2;
+                p2 = p1;
+                p1 = ((2 * dj - 1 + alpha - z) * p2 - (dj - 1 + alpha) * p3)
+                   / dj;
+            }
+            pp = (dn * p1 - (dn + alpha) * p2) / z;
+            z = z1 - p1 / pp;
+            if (fabs(z - z1) <= eps * fabs(z))
+                break;
+        }
+        if (iter == max_iter)
+            return 1;
+        u[i] = z;
+        w[i] = -exp(lgamma(alpha + dn) - lgamma(dn) + z) / (pp * dn * p2);
+    }
+    return 0;
+}
+
+/* Calculates `√(n! / (n + m)!) x^(m / 2) exp(-x / 2) L[n, m](x)`, which is
+   the radial part of `φ[n, ml]` (up to normalization) at `r = √x`.  The
+   recurrence is normalized to avoid overflow. */
+static double orbital(size_t n, size_t m, double x) {
+    const double dm = (double) m;
+    double p0 = 0, p1 = exp(.5 * (dm * log(x) - x - lgamma(dm + 1)));
+    size_t k;
+    for (k = 1; k <= n; ++k) {
+        const double dk = (double) k, p2 = p0;
+        p0 = p1;
+        p1 = (2 * dk - 1 + dm - x) * p0 * sqrt(dk / (dk + dm));
+        if (k > 1)
+            p1 -= (dk - 1 + dm) * p2
+                * sqrt(dk * (dk - 1) / ((dk + dm) * (dk + dm - 1)));
+        p1 /= dk;
+    }
+    return p1;
+}
+
+/* Rebuilds the nodes and orbital tables. */
+static int rebuild(clh2_gl_ctx *ctx, size_t nodes, size_t e_max) {
+    const size_t stride = (nodes + LANES - 1) / LANES * LANES;
+    const size_t rows = (e_max + 1) * (e_max + 1);
+    double *weight, *orb, *u;
+    size_t k, n, m;
+    weight = (double *) malloc(stride * sizeof(*weight));
+    orb = (double *) malloc(rows * stride * sizeof(*orb));
+    u = (double *) malloc(stride * sizeof(*u));
+    if (!weight || !orb || !u ||
+        gauss_laguerre(u, weight, nodes, -.5)) {
+        free(weight);
+        free(orb);
+        free(u);
+        return 1;
+    }
+    for (k = 0; k != nodes; ++k)
+        weight[k] *= sqrt(.5);
+    for (; k != stride; ++k) {
+        weight[k] = 0;
+        u[k] = 1;
+    }
+    /* the orbitals are evaluated at `x = k² / 4 = u / 2` */
+    for (n = 0; n <= e_max; ++n)
+    for (m = 0; m <= e_max; ++m)
+    for (k = 0; k != stride; ++k)
+        orb[(n * (e_max + 1) + m) * stride + k] = orbital(n, m, .5 * u[k]);
+    free(u);
+    free(ctx->weight);
+    free(ctx->orbital);
+    ctx->nodes   = nodes;
+    ctx->stride  = stride;
+    ctx->weight  = weight;
+    ctx->orbital = orb;
+    ctx->e_max   = e_max;
+    return 0;
+}
+
+/* Makes sure the tables can handle the given energy and number of nodes. */
+static int load_tables(clh2_gl_ctx *ctx, size_t nodes, size_t e_max) {
+    if (ctx->fixed_nodes)
+        nodes = ctx->fixed_nodes;
+    if (ctx->weight && nodes <= ctx->nodes && e_max <= ctx->e_max)
+        return 0;
+    if (ctx->weight && nodes < ctx->nodes)
+        nodes = ctx->nodes;
+    if (ctx->weight && e_max < ctx->e_max)
+        e_max = ctx->e_max;
+    return rebuild(ctx, nodes, e_max);
+}
+
+/* Allocates the context and initializes it to zero. */
+clh2_gl_ctx *clh2_gl_ctx_create(size_t nodes) {
+    clh2_gl_ctx *ctx = (clh2_gl_ctx *) calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        fprintf(stderr, "clh2_gl_ctx_create: "
+                "can't allocate the memory needed to create context\n");
+        fflush(stderr);
+        return NULL;
+    }
+    ctx->fixed_nodes = nodes;
+    return ctx;
+}
+
+/* Frees the context. */
+void clh2_gl_ctx_destroy(clh2_gl_ctx *ctx) {
+    if (!ctx)
+        return;
+    free(ctx->weight);
+    free(ctx->orbital);
+    free(ctx);
+}
+
+/* The most demanding element in a basis has four orbitals of energy `e_max`,
+   which yields a polynomial of degree `2 * e_max`. */
+int clh2_gl_ctx_reserve(clh2_gl_ctx *ctx, unsigned e_max) {
+    return load_tables(ctx, (size_t) e_max + 1, e_max);
+}
+
+/* Looks up the orbital that arises from a pair of quanta `a` and `b`. */
+static const double *pair(const clh2_gl_ctx *ctx, size_t a, size_t b) {
+    const size_t n = a < b ? a : b, m = a < b ? b - a : a - b;
+    return ctx->orbital + (n * (ctx->e_max + 1) + m) * ctx->stride;
+}
+
+/* Converts `(n, ml)` into the numbers of right- and left-circular quanta. */
+static void circular(size_t *p, size_t *q, unsigned n, int ml) {
+    const unsigned m = (unsigned) abs(ml);
+    *p = n + (ml > 0 ? m : 0);
+    *q = n + (ml < 0 ? m : 0);
+}
+
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define DIFF(x, y) ((x) > (y) ? (x) - (y) : (y) - (x))
+
+/* Calculates the Coulomb matrix element. */
+double clh2_gl_element(clh2_gl_ctx *ctx, const struct clh2_indices *ix) {
+    size_t p1, q1, p2, q2, p3, q3, p4, q4, e_max, phase, k, l;
+    const double *w, *a, *b, *c, *d;
+    double sum[LANES] = {0}, result = 0;
+    if (ix->ml1 + ix->ml2 != ix->ml3 + ix->ml4)
+        return 0;
+    circular(&p1, &q1, ix->n1, ix->ml1);
+    circular(&p2, &q2, ix->n2, ix->ml2);
+    circular(&p3, &q3, ix->n3, ix->ml3);
+    circular(&p4, &q4, ix->n4, ix->ml4);
+    e_max = MAX(MAX(p1 + q1, p2 + q2), MAX(p3 + q3, p4 + q4));
+    /* the polynomial has degree `(total quanta) / 2` and is integrated
+       exactly by `(degree + 1) / 2` nodes (rounded up) */
+    if (load_tables(ctx, (p1 + q1 + p2 + q2 + p3 + q3 + p4 + q4) / 4 + 1,
+                    e_max)) {
+        fprintf(stderr, "clh2_gl_element: "
+                "can't allocate the memory needed for calculation\n");
+        fflush(stderr);
+        return NAN;
+    }
+    /* the displacement operators of particle 1 contribute `i` per unit of
+       difference in quanta, while those of particle 2 contribute `-i` */
+    phase = (DIFF(p1, p3) + DIFF(q1, q3) + 3 * (DIFF(p2, p4) + DIFF(q2, q4)))
+          / 2 + ix->n1 + ix->n2 + ix->n3 + ix->n4;
+    w = ctx->weight;
+    a = pair(ctx, p1, p3);
+    b = pair(ctx, q1, q3);
+    c = pair(ctx, p2, p4);
+    d = pair(ctx, q2, q4);
+    for (k = 0; k != ctx->stride; k += LANES)
+    for (l = 0; l != LANES; ++l)
+        sum[l] += w[k + l] * a[k + l] * b[k + l] * c[k + l] * d[k + l];
+    for (l = 0; l != LANES; ++l)
+        result += sum[l];
+    return minuspow(phase) * result;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,83 @@
+#ifndef G_E8GWWZ8NDPGSHT3WRJ9PV3SHMVNJX
+#define G_E8GWWZ8NDPGSHT3WRJ9PV3SHMVNJX
+#include "am.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** A context structure used for the Gauss-Laguerre quadrature.
+
+    The context holds the quadrature nodes and weights as well as the values
+    of the oscillator orbitals at the nodes, so it should be reused across as
+    many matrix elements as possible.
+
+    The structure can be created with `#clh2_gl_ctx_create`.  Once created, it
+    must be later destroyed with `#clh2_gl_ctx_destroy`.
+
+*/
+typedef struct clh2_gl_ctx clh2_gl_ctx;
+
+/** Creates a context.
+
+    @param[in] nodes
+    Number of quadrature nodes.  If zero, the number of nodes is chosen
+    automatically so that the quadrature is exact (up to rounding errors) for
+    every matrix element that is calculated.
+
+    @return
+    If successful, a pointer to a valid context.  On failure, `NULL` is
+    returned.
+
+*/
+clh2_gl_ctx *clh2_gl_ctx_create(size_t nodes);
+
+/** Destroys the context, releasing the memory used by it.
+
+    @param[in] ctx
+    Either a pointer to valid context or `NULL`.
+
+*/
+void clh2_gl_ctx_destroy(clh2_gl_ctx *ctx);
+
+/** Precomputes the tables for every orbital up to a given energy.
+
+    This is optional, but it avoids rebuilding the tables several times
+    when the matrix elements are calculated in order of increasing energy.
+
+    @param[in] ctx
+    Pointer to a valid context object.  Must not be `NULL`.
+
+    @param[in] e_max
+    Maximum value of `2 * n + |ml|` among the orbitals of the basis.
+
+    @return
+    `0` on success, or nonzero if the memory could not be allocated.
+
+*/
+int clh2_gl_ctx_reserve(clh2_gl_ctx *ctx, unsigned e_max);
+
+/** Calculates the Coulomb matrix element in a 2D harmonic oscillator basis
+    using Gauss-Laguerre quadrature in momentum space.
+
+    @param[in] ctx
+    Pointer to a valid context object.  It shall remain valid after the
+    invocation of this function regardless of whether an error occurs.
+    Must not be `NULL`.
+
+    @param[in] ix
+    Pointer to a structure containing indices that label the matrix element.
+    Must not be `NULL`.
+
+    @return
+    The value of the matrix element, or `NAN` if an error occurs.
+
+    @warning
+    The context must not be shared between threads.
+
+*/
+double clh2_gl_element(clh2_gl_ctx *ctx, const struct clh2_indices *ix);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
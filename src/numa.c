@@ -0,0 +1,156 @@
+/* sched_setaffinity is a GNU extension; this has no effect if a system
+   header was already included (e.g. via `-include`), in which case the
+   threads are simply not bound */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+# define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+# include <sched.h>
+#endif
+#include "numa.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef __linux__
+
+/* Appends a number to an array, doubling its capacity as needed. */
+static int push(unsigned **list, size_t *count, size_t *capacity, unsigned x) {
+    if (*count == *capacity) {
+        const size_t n = *capacity ? *capacity * 2 : 16;
+        unsigned *p = (unsigned *) realloc(*list, n * sizeof(**list));
+        if (!p)
+            return 1;
+        *list = p;
+        *capacity = n;
+    }
+    (*list)[(*count)++] = x;
+    return 0;
+}
+
+/* Reads a list of numbers in the format used by sysfs (e.g. `0-3,8,10-11`).
+   On success, the list must later be freed. */
+static int read_list(const char *path, unsigned **list, size_t *count) {
+    FILE *f = fopen(path, "r");
+    size_t capacity = 0;
+    unsigned a, b;
+    int c = '\n', err = 0;
+    *list = NULL;
+    *count = 0;
+    if (!f)
+        return 1;
+    while (!err && fscanf(f, "%u", &a) == 1) {
+        b = a;
+        c = getc(f);
+        if (c == '-') {
+            if (fscanf(f, "%u", &b) != 1 || b < a) {
+                err = 1;
+                break;
+            }
+            c = getc(f);
+        }
+        for (;; ++a) {
+            err = push(list, count, &capacity, a);
+            if (err || a == b)
+                break;
+        }
+        if (c != ',')
+            break;
+    }
+    fclose(f);
+    if (err || (c != '\n' && c != EOF)) {
+        free(*list);
+        return 1;
+    }
+    return 0;
+}
+
+int clh2_numa_init(struct clh2_numa *numa) {
+    unsigned *nodes;
+    size_t num_nodes, i, capacity = 0, size = 0;
+    if (read_list("/sys/devices/system/node/online", &nodes, &num_nodes))
+        return 1;
+    numa->num_nodes = 0;
+    numa->cpus = NULL;
+    numa->offsets = (size_t *) malloc((num_nodes + 1) *
+                                      sizeof(*numa->offsets));
+    if (!numa->offsets)
+        goto fail;
+    numa->offsets[0] = 0;
+    for (i = 0; i != num_nodes; ++i) {
+        char path[64];
+        unsigned *cpus;
+        size_t num_cpus, j;
+        sprintf(path, "/sys/devices/system/node/node%u/cpulist", nodes[i]);
+        if (read_list(path, &cpus, &num_cpus))
+            goto fail;
+        for (j = 0; j != num_cpus; ++j)
+            if (push(&numa->cpus, &size, &capacity, cpus[j])) {
+                free(cpus);
+                goto fail;
+            }
+        free(cpus);
+        /* nodes without CPUs (memory only) are of no use to us */
+        if (num_cpus)
+            numa->offsets[++numa->num_nodes] = size;
+    }
+    free(nodes);
+    if (!numa->num_nodes) {
+        clh2_numa_free(numa);
+        return 1;
+    }
+    return 0;
+fail:
+    free(nodes);
+    clh2_numa_free(numa);
+    return 1;
+}
+
+void clh2_numa_free(struct clh2_numa *numa) {
+    free(numa->offsets);
+    free(numa->cpus);
+}
+
+#ifdef CPU_SETSIZE
+int clh2_numa_bind(const struct clh2_numa *numa, unsigned node) {
+    cpu_set_t set;
+    size_t i;
+    CPU_ZERO(&set);
+    for (i = numa->offsets[node]; i != numa->offsets[node + 1]; ++i)
+        if (numa->cpus[i] < CPU_SETSIZE)
+            CPU_SET(numa->cpus[i], &set);
+    return sched_setaffinity(0, sizeof(set), &set) != 0;
+}
+#else
+int clh2_numa_bind(const struct clh2_numa *numa, unsigned node) {
+    (void) numa;
+    (void) node;
+    return 1;
+}
+#endif
+
+#else
+
+int clh2_numa_init(struct clh2_numa *numa) {
+    (void) numa;
+    return 1;
+}
+
+void clh2_numa_free(struct clh2_numa *numa) {
+    (void) numa;
+}
+
+int clh2_numa_bind(const struct clh2_numa *numa, unsigned node) {
+    (void) numa;
+    (void) node;
+    return 1;
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,49 @@
+#ifndef G_R8VD3MQ6KZ2TWJ7HXN5BLC9FPYA4E
+#define G_R8VD3MQ6KZ2TWJ7HXN5BLC9FPYA4E
+#include <stddef.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The NUMA topology of the machine: the nodes that have CPUs, and the CPUs
+    that belong to each of them. */
+struct clh2_numa {
+
+    /** Number of nodes. */
+    unsigned num_nodes;
+
+    /** The CPUs of the `i`-th node are `cpus[offsets[i]]` to
+        `cpus[offsets[i + 1] - 1]`. */
+    size_t *offsets;
+
+    unsigned *cpus;
+
+};
+
+/** Discovers the NUMA topology.  This is only supported on Linux, where the
+    topology is read from `/sys/devices/system/node`.
+
+    @return
+    `0` on success, or nonzero if the topology couldn't be determined.  The
+    object needs to be freed only if the function succeeds.
+
+*/
+int clh2_numa_init(struct clh2_numa *numa);
+
+/** Frees the topology. */
+void clh2_numa_free(struct clh2_numa *numa);
+
+/** Restricts the calling thread to the CPUs of a given node.  Memory that the
+    thread touches first afterwards is then allocated on that node (under the
+    default memory policy).
+
+    @return
+    `0` on success, or nonzero on failure.
+
+*/
+int clh2_numa_bind(const struct clh2_numa *numa, unsigned node);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1,6 +1,8 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "am.h"
 #include "util.h"
 #include "protocol.h"
 #ifdef __cplusplus
@@ -27,7 +29,40 @@ void clh2_main_init(const char **prog, int *argc, char ***argv) {
     ++*argv;
 }
 
+/* Replaces the specification in a request with the indices that it
+   describes, which must be exactly `count` elements.  Returns nonzero if the
+   specification is invalid or doesn't match. */
+static int expand_spec(union clh2_cell *p, size_t count,
+                       enum clh2_kind *kind) {
+    const struct clh2_spec spec = p[1].spec;
+    struct clh2_indicesp *args;
+    size_t n, i;
+    if (!count || clh2_spec_enumerate(&n, NULL, &spec) || n != count)
+        return 1;
+    *kind = spec.antisym ? CLH2_KIND_ANTISYM : CLH2_KIND_PLAIN;
+    if (sizeof(*p) == sizeof(*args))
+        return clh2_spec_enumerate(&n, &p[1].indices, &spec);
+    args = (struct clh2_indicesp *) malloc(count * sizeof(*args));
+    if (!args || clh2_spec_enumerate(&n, args, &spec)) {
+        free(args);
+        return 1;
+    }
+    for (i = 0; i != count; ++i)
+        p[i + 1].indices = args[i];
+    free(args);
+    return 0;
+}
+
+/* Checks that a Fock request has the expected size. */
+static int check_fock(const union clh2_cell *p, size_t count) {
+    size_t n;
+    return !count || p[1].spec.min_shells ||
+           clh2_spec_orbitals(&n, NULL, &p[1].spec) ||
+           (n && n > ((size_t) -1 - 1) / n) || n * n + 1 != count;
+}
+
 void clh2_open_request(union clh2_cell **data, size_t *count,
+                       enum clh2_kind *kind,
                        const char *prog, const char *path) {
     static const size_t cell_size = sizeof(union clh2_cell);
     union clh2_cell *p;
@@ -54,7 +89,26 @@ void clh2_open_request(union clh2_cell **data, size_t *count,
     }
 
     p = (union clh2_cell *) ptr;
-    if (!CLH2_CHECK_MAGIC_IN(p->indices)) {
+    if (CLH2_CHECK_MAGIC_IN(p->indices)) {
+        *kind = CLH2_KIND_PLAIN;
+    } else if (CLH2_INDICES_EQUAL(p->indices, clh2_magic_in_antisym)) {
+        *kind = CLH2_KIND_ANTISYM;
+    } else if (CLH2_INDICES_EQUAL(p->indices, clh2_magic_in_spec)) {
+        if (expand_spec(p, size / cell_size - 1, kind)) {
+            (void) rf_munmap(ptr, size);
+            (void) fprintf(stderr, "%s: bad specification in %s\n",
+                           prog, path);
+            exit(EXIT_FAILURE);
+        }
+    } else if (CLH2_INDICES_EQUAL(p->indices, clh2_magic_in_fock)) {
+        if (check_fock(p, size / cell_size - 1)) {
+            (void) rf_munmap(ptr, size);
+            (void) fprintf(stderr, "%s: bad specification in %s\n",
+                           prog, path);
+            exit(EXIT_FAILURE);
+        }
+        *kind = CLH2_KIND_FOCK;
+    } else {
         (void) rf_munmap(ptr, size);
         (void) fprintf(stderr, "%s: bad magic number in %s\n",
                        prog, path);
@@ -78,6 +132,199 @@ void clh2_close_request(union clh2_cell *data, size_t count) {
     (void) rf_munmap(p, size);
 }
 
+struct clh2_indicesp clh2_exchange_indices(const struct clh2_indicesp *p) {
+    struct clh2_indicesp r = *p;
+    r.n3  = p->n4;
+    r.ml3 = p->ml4;
+    r.n4  = p->n3;
+    r.ml4 = p->ml3;
+    return r;
+}
+
+void clh2_unpack_indices(struct clh2_indices *ix,
+                         const struct clh2_indicesp *p) {
+    ix->n1  = p->n1;
+    ix->ml1 = p->ml1;
+    ix->n2  = p->n2;
+    ix->ml2 = p->ml2;
+    ix->n3  = p->n3;
+    ix->ml3 = p->ml3;
+    ix->n4  = p->n4;
+    ix->ml4 = p->ml4;
+}
+
+double clh2_evaluate_cell(clh2_element_fn *element, void *ctx,
+                          const struct clh2_indicesp *p,
+                          enum clh2_kind kind) {
+    struct clh2_indices ix;
+    double value;
+    clh2_unpack_indices(&ix, p);
+    value = (*element)(ctx, &ix);
+    if (kind == CLH2_KIND_ANTISYM) {
+        const struct clh2_indicesp x = clh2_exchange_indices(p);
+        clh2_unpack_indices(&ix, &x);
+        value -= (*element)(ctx, &ix);
+    }
+    return value;
+}
+
+static int shell(const struct clh2_orbital *o) {
+    return 2 * o->n + abs(o->ml);
+}
+
+void clh2_fock_init(struct clh2_fock *f, const union clh2_cell *data,
+                    const char *prog) {
+    size_t N, i;
+    int K, ml;
+    f->spec = data[0].spec;
+    (void) clh2_spec_orbitals(&N, NULL, &f->spec);
+    K = f->spec.num_shells;
+    f->num_orbitals = N;
+    f->orbitals = (struct clh2_orbital *) malloc(N * sizeof(*f->orbitals));
+    f->block = (size_t *) malloc(2 * (size_t) K * sizeof(*f->block));
+    f->density = (double *) malloc(N * N * sizeof(*f->density));
+    f->fock = (double *) malloc(N * N * sizeof(*f->fock));
+    if (!f->orbitals || !f->block || !f->density || !f->fock) {
+        (void) fprintf(stderr, "%s: can't allocate memory for the Fock "
+                       "matrix\n", prog);
+        exit(EXIT_FAILURE);
+    }
+    (void) clh2_spec_orbitals(&N, f->orbitals, &f->spec);
+    for (i = 0, ml = 1 - K; ml <= K; ++ml) {
+        while (i != N && f->orbitals[i].ml < ml)
+            ++i;
+        f->block[ml + K - 1] = i;
+    }
+    /* the density matrix is overwritten by the result later */
+    for (i = 0; i != N * N; ++i)
+        f->density[i] = data[i + 1].value;
+}
+
+void clh2_fock_row(struct clh2_fock *f, size_t p, clh2_element_fn *element,
+                   void *ctx) {
+    const struct clh2_orbital *o = f->orbitals;
+    const size_t N = f->num_orbitals;
+    const int K = f->spec.num_shells;
+    const int pairs = f->spec.truncation == CLH2_TRUNCATE_PAIRS;
+    const enum clh2_kind kind =
+        f->spec.antisym ? CLH2_KIND_ANTISYM : CLH2_KIND_PLAIN;
+    struct clh2_indicesp ix;
+    size_t q, r, s;
+    double *row = f->fock + p * N;
+
+    ix.n1  = o[p].n;
+    ix.ml1 = o[p].ml;
+    for (r = 0; r != N; ++r) {
+        row[r] = 0;
+        ix.n3  = o[r].n;
+        ix.ml3 = o[r].ml;
+        for (q = 0; q != N; ++q) {
+            /* by conservation of `ml`, only one block of `s` contributes */
+            const int ml = o[p].ml + o[q].ml - o[r].ml;
+            if (ml <= -K || ml >= K)
+                continue;
+            ix.n2  = o[q].n;
+            ix.ml2 = o[q].ml;
+            for (s = f->block[ml + K - 1]; s != f->block[ml + K]; ++s) {
+                const double rho = f->density[q * N + s];
+                if (rho == 0 || (pairs &&
+                                 (shell(&o[p]) + shell(&o[q]) >= K ||
+                                  shell(&o[r]) + shell(&o[s]) >= K)))
+                    continue;
+                ix.n4  = o[s].n;
+                ix.ml4 = o[s].ml;
+                row[r] += rho * clh2_evaluate_cell(element, ctx, &ix, kind);
+            }
+        }
+    }
+}
+
+void clh2_fock_finish(struct clh2_fock *f, union clh2_cell *data,
+                      size_t count) {
+    const size_t N = f->num_orbitals;
+    size_t i;
+    for (i = 0; i != N * N; ++i)
+        data[i].value = f->fock[i];
+    for (; i != count; ++i)
+        data[i].value = 0;
+    free(f->orbitals);
+    free(f->block);
+    free(f->density);
+    free(f->fock);
+}
+
+struct sort_entry {
+    uint64_t key;
+    size_t index;
+};
+
+static int compare_entries(const void *x, const void *y) {
+    const struct sort_entry *a = (const struct sort_entry *) x;
+    const struct sort_entry *b = (const struct sort_entry *) y;
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+    return a->index < b->index ? -1 : a->index > b->index;
+}
+
+/* Packs the sort key of a cell into 64 bits: the total `n` and the total
+   `|ml|` (9 bits each), the first three `n` values and the first three `|ml|`
+   values (7 bits each), and the signs of the four `ml` values.  The last `n`
+   and `|ml|` are implied by the totals.  Values that don't fit are truncated,
+   which only makes the grouping less effective. */
+static uint64_t sort_key(const struct clh2_indicesp *i) {
+    const unsigned n = (unsigned) i->n1 + i->n2 + i->n3 + i->n4;
+    const unsigned m = (unsigned) (abs(i->ml1) + abs(i->ml2) +
+                                   abs(i->ml3) + abs(i->ml4));
+    uint64_t key = n & 0x1ff;
+    key = key << 9 | (m & 0x1ff);
+    key = key << 7 | (i->n1 & 0x7f);
+    key = key << 7 | (i->n2 & 0x7f);
+    key = key << 7 | (i->n3 & 0x7f);
+    key = key << 7 | ((unsigned) abs(i->ml1) & 0x7f);
+    key = key << 7 | ((unsigned) abs(i->ml2) & 0x7f);
+    key = key << 7 | ((unsigned) abs(i->ml3) & 0x7f);
+    key = key << 1 | (i->ml1 < 0);
+    key = key << 1 | (i->ml2 < 0);
+    key = key << 1 | (i->ml3 < 0);
+    key = key << 1 | (i->ml4 < 0);
+    return key;
+}
+
+int clh2_sort_cells(size_t *order, size_t count,
+                    const union clh2_cell *data) {
+    struct sort_entry *entries;
+    size_t i;
+    entries = (struct sort_entry *) malloc((count ? count : 1) *
+                                           sizeof(*entries));
+    if (!entries)
+        return 1;
+    for (i = 0; i != count; ++i) {
+        entries[i].key = sort_key(&data[order[i]].indices);
+        entries[i].index = order[i];
+    }
+    qsort(entries, count, sizeof(*entries), &compare_entries);
+    for (i = 0; i != count; ++i)
+        order[i] = entries[i].index;
+    free(entries);
+    return 0;
+}
+
+int clh2_sort_request(size_t **order, const union clh2_cell *data,
+                      size_t count) {
+    size_t *p, i;
+    p = (size_t *) malloc((count ? count : 1) * sizeof(*p));
+    if (!p)
+        return 1;
+    for (i = 0; i != count; ++i)
+        p[i] = i;
+    if (clh2_sort_cells(p, count, data)) {
+        free(p);
+        return 1;
+    }
+    *order = p;
+    return 0;
+}
+
 #ifdef __cplusplus
 }
 #endif
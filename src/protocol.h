@@ -4,6 +4,7 @@
 
 union clh2_cell {
     struct clh2_indicesp indices;
+    struct clh2_spec spec;
     double value;
 };
 
@@ -12,11 +13,42 @@ static const double clh2_magic_out = 2.5883786e-12;
 static const struct clh2_indicesp clh2_magic_in =
     {83, -57, 55, 38, 26, -81, 45, 59};
 
+/* Requests with this magic number ask for antisymmetrized matrix elements,
+   `<1 2|V|3 4> - <1 2|V|4 3>`, instead. */
+static const struct clh2_indicesp clh2_magic_in_antisym =
+    {83, -57, 55, 38, 26, -81, 45, -59};
+
+/* Requests with this magic number carry a single `struct clh2_spec` in
+   place of the indices, followed by room for the values of the elements it
+   describes.  The provider enumerates the indices itself. */
+static const struct clh2_indicesp clh2_magic_in_spec =
+    {83, -57, 55, 38, 26, -81, 45, 58};
+
+/* Requests with this magic number ask for a Fock contraction (see
+   `clh2_request_fock`).  The first cell holds a `struct clh2_spec`, and the
+   remaining `N * N` cells hold the density matrix.  The provider replaces
+   the first `N * N` cells with the result and zeroes the last one. */
+static const struct clh2_indicesp clh2_magic_in_fock =
+    {83, -57, 55, 38, 26, -81, 45, 57};
+
+#define CLH2_INDICES_EQUAL(x, y)                                            \
+    ((x).n1 == (y).n1 && (x).ml1 == (y).ml1 &&                              \
+     (x).n2 == (y).n2 && (x).ml2 == (y).ml2 &&                              \
+     (x).n3 == (y).n3 && (x).ml3 == (y).ml3 &&                              \
+     (x).n4 == (y).n4 && (x).ml4 == (y).ml4)
+
 #define CLH2_CHECK_MAGIC_IN(indices)                                        \
-    (indices.n1 == clh2_magic_in.n1 && indices.ml1 == clh2_magic_in.ml1 &&  \
-     indices.n2 == clh2_magic_in.n2 && indices.ml2 == clh2_magic_in.ml2 &&  \
-     indices.n3 == clh2_magic_in.n3 && indices.ml3 == clh2_magic_in.ml3 &&  \
-     indices.n4 == clh2_magic_in.n4 && indices.ml4 == clh2_magic_in.ml4)
+    CLH2_INDICES_EQUAL(indices, clh2_magic_in)
+
+/* The kinds of requests, as determined by the input magic number. */
+enum clh2_kind {
+    CLH2_KIND_PLAIN,
+    CLH2_KIND_ANTISYM,
+    CLH2_KIND_FOCK
+};
+
+/* (defined in `am.h`) */
+struct clh2_indices;
 
 #ifdef __cplusplus
 extern "C" {
@@ -25,10 +57,73 @@ extern "C" {
 void clh2_main_init(const char **prog, int *argc, char ***argv);
 
 void clh2_open_request(union clh2_cell **data, size_t *count,
+                       enum clh2_kind *kind,
                        const char *prog, const char *path);
 
 void clh2_close_request(union clh2_cell *data, size_t count);
 
+/* Swaps the 3rd and 4th particles, i.e. `<1 2|V|3 4>` -> `<1 2|V|4 3>`. */
+struct clh2_indicesp clh2_exchange_indices(const struct clh2_indicesp *p);
+
+/* Converts the indices of a cell into the form taken by the providers. */
+void clh2_unpack_indices(struct clh2_indices *ix,
+                         const struct clh2_indicesp *p);
+
+/* Calculates a single matrix element using the context of a provider. */
+typedef double clh2_element_fn(void *ctx, const struct clh2_indices *ix);
+
+/* Calculates the value of a cell of a plain or antisymmetrized request,
+   computing the exchange term (if needed) right after the direct term
+   while the caches are still warm. */
+double clh2_evaluate_cell(clh2_element_fn *element, void *ctx,
+                          const struct clh2_indicesp *p,
+                          enum clh2_kind kind);
+
+/* The state of a Fock request (see `clh2_magic_in_fock`) while it is being
+   evaluated. */
+struct clh2_fock {
+    struct clh2_spec spec;
+    struct clh2_orbital *orbitals;
+    size_t num_orbitals;
+
+    /* The orbitals with a given `ml` are `block[ml + K - 1]` to
+       `block[ml + K] - 1`, where `K` is the number of shells. */
+    size_t *block;
+
+    double *density, *fock;
+};
+
+/* Copies the density matrix out of a Fock request.  Exits on failure. */
+void clh2_fock_init(struct clh2_fock *f, const union clh2_cell *data,
+                    const char *prog);
+
+/* Calculates the row `p` of the result.  The elements that contribute are
+   generated on the fly and evaluated one at a time with `element`
+   (antisymmetrized if the request says so).  Different rows may be
+   calculated concurrently. */
+void clh2_fock_row(struct clh2_fock *f, size_t p, clh2_element_fn *element,
+                   void *ctx);
+
+/* Stores the result in the request and frees the state. */
+void clh2_fock_finish(struct clh2_fock *f, union clh2_cell *data,
+                      size_t count);
+
+/* Computes a permutation of the cells that groups together similar matrix
+   elements: the cells are sorted by `n1 + n2 + n3 + n4`, then by
+   `|ml1| + |ml2| + |ml3| + |ml4|`, then by the `n` values, then by the `|ml|`
+   values, and finally by the signs of the `ml` values.  Thus, elements that
+   differ only in the signs end up next to each other.  The array must be
+   freed using `free`.  Returns zero on success, or nonzero if the memory
+   could not be allocated. */
+int clh2_sort_request(size_t **order, const union clh2_cell *data,
+                      size_t count);
+
+/* Sorts some of the cells, given by their positions in `order`, in the same
+   way as `clh2_sort_request`.  Returns zero on success, or nonzero if the
+   memory could not be allocated. */
+int clh2_sort_cells(size_t *order, size_t count,
+                    const union clh2_cell *data);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,86 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <clh2.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* so that every `ml` fits in a `signed char` */
+#define NUM_SHELLS_MAX 128
+
+/* Returns the shell of an orbital. */
+static int shell(int n, int ml) {
+    return 2 * n + abs(ml);
+}
+
+static int is_valid(const struct clh2_spec *spec) {
+    return spec->num_shells <= NUM_SHELLS_MAX &&
+           (spec->truncation == CLH2_TRUNCATE_ORBITALS ||
+            spec->truncation == CLH2_TRUNCATE_PAIRS);
+}
+
+int clh2_spec_orbitals(size_t *count, struct clh2_orbital *orbitals,
+                       const struct clh2_spec *spec) {
+    int K, ml, n;
+    size_t i = 0;
+    if (!count || !spec || !is_valid(spec))
+        return EINVAL;
+    K = spec->num_shells;
+    for (ml = 1 - K; ml < K; ++ml)
+        for (n = 0; shell(n, ml) < K; ++n) {
+            if (orbitals) {
+                orbitals[i].n  = (unsigned char) n;
+                orbitals[i].ml = (signed char) ml;
+            }
+            ++i;
+        }
+    *count = i;
+    return 0;
+}
+
+int clh2_spec_enumerate(size_t *count, struct clh2_indicesp *args,
+                        const struct clh2_spec *spec) {
+    int K, ml1, ml2, ml3, ml4, n1, n2, n3, n4;
+    size_t i = 0;
+    if (!count || !spec || !is_valid(spec))
+        return EINVAL;
+    K = spec->num_shells;
+    for (ml1 = 1 - K; ml1 < K; ++ml1)
+    for (ml2 = 1 - K; ml2 < K; ++ml2)
+    for (ml3 = 1 - K; ml3 < K; ++ml3)
+    for (ml4 = 1 - K; ml4 < K; ++ml4) {
+        if (!spec->all_ml && ml1 + ml2 != ml3 + ml4)
+            continue;
+        for (n1 = 0; shell(n1, ml1) < K; ++n1)
+        for (n2 = 0; shell(n2, ml2) < K; ++n2)
+        for (n3 = 0; shell(n3, ml3) < K; ++n3)
+        for (n4 = 0; shell(n4, ml4) < K; ++n4) {
+            const int e1 = shell(n1, ml1), e2 = shell(n2, ml2),
+                      e3 = shell(n3, ml3), e4 = shell(n4, ml4);
+            if (spec->truncation == CLH2_TRUNCATE_PAIRS &&
+                (e1 + e2 >= K || e3 + e4 >= K))
+                continue;
+            if (e1 < spec->min_shells && e2 < spec->min_shells &&
+                e3 < spec->min_shells && e4 < spec->min_shells)
+                continue;
+            if (args) {
+                args[i].n1  = (unsigned char) n1;
+                args[i].ml1 = (signed char) ml1;
+                args[i].n2  = (unsigned char) n2;
+                args[i].ml2 = (signed char) ml2;
+                args[i].n3  = (unsigned char) n3;
+                args[i].ml3 = (signed char) ml3;
+                args[i].n4  = (unsigned char) n4;
+                args[i].ml4 = (signed char) ml4;
+            }
+            if (!++i)
+                return ENOMEM;
+        }
+    }
+    *count = i;
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
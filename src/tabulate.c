@@ -1,6 +1,8 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <clh2.h>
 
 /* chosen partly to avoid overflow errors */
@@ -14,36 +16,103 @@ static unsigned char n_max(unsigned char num_shells, signed char ml) {
     return (unsigned char) (num_shells - abs_ml + 1) / 2;
 }
 
-#define ITERATE(block)                                          \
-    for (ml1 = ml_min; ml1 < num_shells; ++ml1)                 \
-    for (ml2 = ml_min; ml2 < num_shells; ++ml2)                 \
-    for (ml3 = ml_min; ml3 < num_shells; ++ml3) {               \
-        const int ml4_int = (ml1 + ml2 - ml3);                  \
-        if (ml4_int < 1 - num_shells || ml4_int >= num_shells)  \
-            continue;                                           \
-        ml4 = (signed char) ml4_int;                            \
-        for (n1 = 0; n1 < n_max(num_shells, ml1); ++n1)         \
-        for (n2 = 0; n2 < n_max(num_shells, ml2); ++n2)         \
-        for (n3 = 0; n3 < n_max(num_shells, ml3); ++n3)         \
-        for (n4 = 0; n4 < n_max(num_shells, ml4); ++n4)         \
-            block                                               \
+/* check whether the orbital lies within the given number of shells */
+static int in_shells(unsigned char num_shells, unsigned char n, signed char ml) {
+    return 2 * n + abs(ml) < num_shells;
+}
+
+/* check whether all four orbitals lie within the given number of shells */
+static int all_in_shells(unsigned char num_shells,
+                         const struct clh2_indicesp *p) {
+    return in_shells(num_shells, p->n1, p->ml1) &&
+           in_shells(num_shells, p->n2, p->ml2) &&
+           in_shells(num_shells, p->n3, p->ml3) &&
+           in_shells(num_shells, p->n4, p->ml4);
+}
+
+/* read the number of shells from the first line of an existing table */
+static int read_old_header(FILE *f, unsigned char *num_shells) {
+    char line[256];
+    int n;
+    if (!fgets(line, sizeof(line), f) ||
+        sscanf(line, "# Coulomb matrix elements for up to %d shell", &n) != 1
+        || n < 0 || n > NUM_SHELLS_MAX)
+        return 1;
+    *num_shells = (unsigned char) n;
+    return 0;
+}
+
+/* read the next row of an existing table, skipping over comments; returns
+   nonzero if there are no more rows or if the row is malformed */
+static int read_old_row(FILE *f, struct clh2_indicesp *p, double *value) {
+    char line[256];
+    int i[8];
+    do {
+        if (!fgets(line, sizeof(line), f))
+            return 1;
+    } while (*line == '#');
+    if (sscanf(line, "%d %d %d %d %d %d %d %d %lf",
+               &i[0], &i[1], &i[2], &i[3],
+               &i[4], &i[5], &i[6], &i[7], value) != 9)
+        return 1;
+    p->n1  = (unsigned char) i[0];
+    p->ml1 = (signed char) i[1];
+    p->n2  = (unsigned char) i[2];
+    p->ml2 = (signed char) i[3];
+    p->n3  = (unsigned char) i[4];
+    p->ml3 = (signed char) i[5];
+    p->n4  = (unsigned char) i[6];
+    p->ml4 = (signed char) i[7];
+    return 0;
+}
+
+/* iterates over the indices `p` of every element in the table, in the
+   canonical order of `clh2_spec` */
+#define ITERATE(block)                                                  \
+    for (p.ml1 = ml_min; p.ml1 < num_shells; ++p.ml1)                   \
+    for (p.ml2 = ml_min; p.ml2 < num_shells; ++p.ml2)                   \
+    for (p.ml3 = ml_min; p.ml3 < num_shells; ++p.ml3) {                 \
+        const int ml4_int = (p.ml1 + p.ml2 - p.ml3);                    \
+        if (ml4_int < 1 - num_shells || ml4_int >= num_shells)          \
+            continue;                                                   \
+        p.ml4 = (signed char) ml4_int;                                  \
+        for (p.n1 = 0; p.n1 < n_max(num_shells, p.ml1); ++p.n1)         \
+        for (p.n2 = 0; p.n2 < n_max(num_shells, p.ml2); ++p.n2)         \
+        for (p.n3 = 0; p.n3 < n_max(num_shells, p.ml3); ++p.n3)         \
+        for (p.n4 = 0; p.n4 < n_max(num_shells, p.ml4); ++p.n4)         \
+            block                                                       \
     }
 
 int main(int argc, char **argv) {
-    struct clh2_indicesp *indices;
+    struct clh2_indicesp p;
+    struct clh2_spec spec;
     const double *results;
-    size_t count, size = 0, i = 0;
+    double cost = 0;
+    size_t count = 0, num_requested, j = 0;
     long num_shells_long;
-    unsigned char num_shells, n1, n2, n3, n4;
-    signed char ml1, ml2, ml3, ml4, ml_min;
+    unsigned char num_shells, old_num_shells = 0;
+    signed char ml_min;
+    const char *old_path = NULL;
+    FILE *old_file = NULL;
     char *arg_end;
     int errnum;
 
+    /* reuse the elements of an existing table if requested */
+    if (argc > 2 && !strcmp(argv[1], "--extend")) {
+        old_path = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+
     /* print usage info if arguments aren't provided */
     if (argc < 2 || argc > 3) {
-        fprintf(stderr, "Usage: tabulate NUM_SHELLS [PROVIDER]\n"
+        fprintf(stderr, "Usage: tabulate [--extend OLD_TABLE] NUM_SHELLS"
+                        " [PROVIDER]\n"
                         "  where NUM_SHELLS is the number of shells\n"
-                        "    and PROVIDER   is the tabulation provider\n");
+                        "    and PROVIDER   is the tabulation provider\n"
+                        "    and OLD_TABLE  is the output of a previous run"
+                        " with fewer shells,\n"
+                        "                   whose elements are reused\n");
         return EXIT_FAILURE;
     }
 
@@ -60,59 +129,93 @@ int main(int argc, char **argv) {
     num_shells = (unsigned char) num_shells_long;
     ml_min     = (signed char) (1 - num_shells);
 
-    /* allocate memory for indices */
-    ITERATE({
-        size += sizeof(*indices);
-        if (size < sizeof(*indices)) {
-            fprintf(stderr, "tabulate: not enough memory\n");
+    /* open the existing table */
+    if (old_path) {
+        old_file = fopen(old_path, "r");
+        if (!old_file) {
+            fprintf(stderr, "tabulate: can't open %s: %s\n",
+                    old_path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        if (read_old_header(old_file, &old_num_shells)) {
+            fprintf(stderr, "tabulate: not a table: %s\n", old_path);
+            fclose(old_file);
             return EXIT_FAILURE;
         }
+        if (old_num_shells > num_shells) {
+            fprintf(stderr, "tabulate: %s has more shells than requested\n",
+                    old_path);
+            fclose(old_file);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* count the elements and estimate the cost (the cost is always that of
+       the whole table, even though only the elements that aren't in the old
+       table are requested) */
+    ITERATE({
+        cost += clh2_element_cost(&p);
+        ++count;
     });
-    indices = (struct clh2_indicesp *) malloc(size);
-    if (!indices) {
-        fprintf(stderr, "tabulate: failed to allocate ~%.8g KiB\n",
-                (double) size / 1024.);
+    memset(&spec, 0, sizeof(spec));
+    spec.num_shells = num_shells;
+    spec.min_shells = old_num_shells;
+    if (clh2_spec_enumerate(&num_requested, NULL, &spec)) {
+        fprintf(stderr, "tabulate: too many elements\n");
+        if (old_file)
+            fclose(old_file);
         return EXIT_FAILURE;
     }
 
     /* print header */
-    count = size / sizeof(*indices);
     printf("# Coulomb matrix elements for up to %d shell(s)\n"
            "# Total of ~%.8g row(s)\n"
+           "# Estimated cost of ~%.8g iteration(s)\n"
            "# %3s %3s %3s %3s %3s %3s %3s %3s %22s\n",
-           num_shells, (double) count,
+           num_shells, (double) count, cost,
            "n1", "ml1", "n2", "ml2",
            "n3", "ml3", "n4", "ml4", "value");
+    fflush(stdout);
 
-    /* calculate matrix elements */
-    ITERATE({
-        indices[i].n1  = n1;
-        indices[i].ml1 = ml1;
-        indices[i].n2  = n2;
-        indices[i].ml2 = ml2;
-        indices[i].n3  = n3;
-        indices[i].ml3 = ml3;
-        indices[i].n4  = n4;
-        indices[i].ml4 = ml4;
-        ++i;
-    });
-    errnum = clh2_request(&results, argv[2], count, indices);
+    /* when run interactively, let the provider report the ETA */
+    if (isatty(STDERR_FILENO) && !getenv("CLH2_PROGRESS"))
+        (void) putenv((char *) "CLH2_PROGRESS=1");
+
+    /* calculate matrix elements: the provider enumerates the indices
+       itself, in the same order as we do */
+    errnum = clh2_request_spec(&results, argv[2], &spec);
     if (errnum) {
         fprintf(stderr, "tabulate: error: %s\n", strerror(errnum));
-        free(indices);
+        if (old_file)
+            fclose(old_file);
         return EXIT_FAILURE;
     }
 
-    /* print results */
-    for (i = 0; i != count; ++i) {
-        const struct clh2_indicesp *p = &indices[i];
+    /* print results, merging in the old table: its rows are enumerated in
+       the same order, so they appear as a subsequence of the new table */
+    ITERATE({
+        double value;
+        if (all_in_shells(old_num_shells, &p)) {
+            struct clh2_indicesp q;
+            if (read_old_row(old_file, &q, &value) ||
+                memcmp(&p, &q, sizeof(q))) {
+                fprintf(stderr, "tabulate: %s does not match the expected "
+                        "rows for %d shell(s)\n", old_path, old_num_shells);
+                clh2_free(num_requested, results);
+                fclose(old_file);
+                return EXIT_FAILURE;
+            }
+        } else {
+            value = results[j++];
+        }
         printf("  %3d %3d %3d %3d %3d %3d %3d %3d %22.14e\n",
-               (int) p->n1, (int) p->ml1, (int) p->n2, (int) p->ml2,
-               (int) p->n3, (int) p->ml3, (int) p->n4, (int) p->ml4,
-               results[i]);
-    }
+               (int) p.n1, (int) p.ml1, (int) p.n2, (int) p.ml2,
+               (int) p.n3, (int) p.ml3, (int) p.n4, (int) p.ml4,
+               value);
+    });
 
-    clh2_free(count, results);
-    free(indices);
+    clh2_free(num_requested, results);
+    if (old_file)
+        fclose(old_file);
     return EXIT_SUCCESS;
 }
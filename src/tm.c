@@ -0,0 +1,245 @@
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "tm.h"
+#ifndef NAN
+# define NAN (0./0.)
+#endif
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The method: in terms of the circular quanta of the oscillator, a state
+   `(n, ml)` has `p = n + (|ml| + ml) / 2` right-circular quanta and
+   `q = n + (|ml| - ml) / 2` left-circular quanta.  The transformation to
+   centre-of-mass and relative coordinates `(r1 ± r2) / √2` does not mix the
+   two kinds of quanta, so the 2D Moshinsky bracket factorizes into a product
+   of two 1D brackets (one per kind).  The Coulomb operator `1 / (√2 r)` acts
+   only on the relative motion and conserves its angular momentum, leaving a
+   double sum over the centre-of-mass quanta. */
+
+/* A structure used to memoize the brackets and radial integrals. */
+struct clh2_tm_ctx {
+    /* Pascal's triangle for rows `0` to `binom_rows - 1` */
+    double *binom;
+    size_t  binom_rows;
+    /* 1D brackets `<P, s - P | p, s - p>` for `s < bracket_rows` */
+    double *bracket;
+    size_t  bracket_rows;
+    /* relative matrix elements for `|m| < radial_m` and `n, n' < radial_n` */
+    double *radial;
+    size_t  radial_m;
+    size_t  radial_n;
+};
+
+/* Calculates `(-1) ^ n`. */
+static int minuspow(unsigned n) { return (n % 2) ? -1 : 1; }
+
+/* Calculates `ln(n!)`. */
+static double lfac(size_t n) { return lgamma((double) n + 1); }
+
+/* Calculates `Γ(j + 1/2) / (Γ(1/2) j!)`, the expansion coefficients of
+   `L[n, m]` in terms of `L[k, m - 1/2]`. */
+static double halfcoef(size_t j) {
+    return exp(lgamma((double) j + .5) - lgamma(.5) - lfac(j));
+}
+
+/* Offset of the block for a given `s` within the bracket table. */
+static size_t bracket_offset(size_t s) {
+    return s * (s + 1) * (2 * s + 1) / 6;
+}
+
+/* Builds Pascal's triangle up to (and including) row `max`.  Entries are
+   integers, which remain exact as long as they are below `2^53`. */
+static int binom_load(clh2_tm_ctx *ctx, size_t max) {
+    size_t rows = max + 1, r, k;
+    double *binom = (double *) realloc(ctx->binom,
+                                       rows * (rows + 1) / 2 * sizeof(*binom));
+    if (!binom)
+        return 1;
+    ctx->binom = binom;
+    for (r = ctx->binom_rows; r != rows; ++r) {
+        double *row = binom + r * (r + 1) / 2;
+        row[0] = row[r] = 1;
+        for (k = 1; k < r; ++k)
+            row[k] = row[k - 1 - r] + row[k - r];
+    }
+    ctx->binom_rows = rows;
+    return 0;
+}
+
+/* Builds the table of 1D brackets up to (and including) `s = max`:
+
+       <P, Q | p, q> = 2^(-s/2) √(P! Q! / (p! q!))
+                     * Σ[i] (-1)^(q - P + i) C(p, i) C(q, P - i)
+
+   The alternating sum is done in integers (exactly) before scaling. */
+static int bracket_load(clh2_tm_ctx *ctx, size_t max) {
+    size_t rows = max + 1, s;
+    double *bracket;
+    if (ctx->binom_rows < rows && binom_load(ctx, max))
+        return 1;
+    bracket = (double *) realloc(ctx->bracket,
+                                 bracket_offset(rows) * sizeof(*bracket));
+    if (!bracket)
+        return 1;
+    ctx->bracket = bracket;
+    for (s = ctx->bracket_rows; s != rows; ++s) {
+        double *block = bracket + bracket_offset(s);
+        size_t p, P;
+        for (p = 0; p <= s; ++p)
+        for (P = 0; P <= s; ++P) {
+            const double *cp = ctx->binom + p * (p + 1) / 2;
+            const double *cq = ctx->binom + (s - p) * (s - p + 1) / 2;
+            size_t q = s - p, Q = s - P, i;
+            double sum = 0;
+            for (i = P > q ? P - q : 0; i <= p && i <= P; ++i)
+                sum += minuspow((unsigned) (q + P + i)) * cp[i] * cq[P - i];
+            block[p * (s + 1) + P] = sum * exp(.5 * (lfac(P) + lfac(Q)
+                                                     - lfac(p) - lfac(q)
+                                                     - (double) s * log(2.)));
+        }
+    }
+    ctx->bracket_rows = rows;
+    return 0;
+}
+
+/* Calculates the radial integral `∫ R[n, m](r) R[n', m](r) dr`, which is the
+   matrix element of `1 / r`.  Expanding the Laguerre polynomials in terms of
+   `L[k, m - 1/2]` makes every term positive, so there is no cancellation. */
+static double radial_integral(size_t n, size_t np, size_t m) {
+    const double norm = .5 * (lfac(n) + lfac(np) - lfac(n + m) - lfac(np + m));
+    size_t k;
+    double sum = 0;
+    for (k = 0; k <= n && k <= np; ++k)
+        sum += halfcoef(n - k) * halfcoef(np - k)
+             * exp(lgamma((double) (k + m) + .5) - lfac(k) + norm);
+    return sum;
+}
+
+/* Builds the table of relative matrix elements `<n m| 1 / (√2 r) |n' m>` for
+   `|m| <= m_max` and `n, n' <= n_max`.  The phase `(-1)^(n + n')` relates
+   the conventional radial functions to the circular-quanta states. */
+static int radial_load(clh2_tm_ctx *ctx, size_t m_max, size_t n_max) {
+    size_t rm = m_max + 1, rn = n_max + 1, m, n, np;
+    double *radial = (double *) realloc(ctx->radial,
+                                        rm * rn * rn * sizeof(*radial));
+    if (!radial)
+        return 1;
+    ctx->radial = radial;
+    for (m = 0; m != rm; ++m)
+    for (n = 0; n != rn; ++n)
+    for (np = 0; np != rn; ++np)
+        radial[(m * rn + n) * rn + np] = minuspow((unsigned) (n + np))
+                                       * radial_integral(n, np, m)
+                                       * sqrt(.5);
+    ctx->radial_m = rm;
+    ctx->radial_n = rn;
+    return 0;
+}
+
+/* Builds the tables so that they cover the given maximums.  Like the caches
+   in `clh2_element`, the tables are grown to twice the required size to
+   amortize the cost of growing. */
+static int load_tables(clh2_tm_ctx *ctx,
+                       size_t s_max, size_t m_max, size_t n_max) {
+    if (ctx->bracket_rows <= s_max && bracket_load(ctx, s_max * 2))
+        return 1;
+    if ((ctx->radial_m <= m_max || ctx->radial_n <= n_max) &&
+        radial_load(ctx,
+                    ctx->radial_m <= m_max ? m_max * 2 : ctx->radial_m - 1,
+                    ctx->radial_n <= n_max ? n_max * 2 : ctx->radial_n - 1))
+        return 1;
+    return 0;
+}
+
+/* Allocates the context and initializes it to zero. */
+clh2_tm_ctx *clh2_tm_ctx_create(void) {
+    clh2_tm_ctx *ctx = (clh2_tm_ctx *) calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        fprintf(stderr, "clh2_tm_ctx_create: "
+                "can't allocate the memory needed to create context\n");
+        fflush(stderr);
+    }
+    return ctx;
+}
+
+/* Frees the context. */
+void clh2_tm_ctx_destroy(clh2_tm_ctx *ctx) {
+    if (!ctx)
+        return;
+    free(ctx->binom);
+    free(ctx->bracket);
+    free(ctx->radial);
+    free(ctx);
+}
+
+/* Looks up the 1D bracket `<P, p + q - P | p, q>`. */
+static double bracket(const clh2_tm_ctx *ctx, size_t p, size_t q, size_t P) {
+    const size_t s = p + q;
+    return ctx->bracket[bracket_offset(s) + p * (s + 1) + P];
+}
+
+/* Looks up the relative matrix element. */
+static double radial(const clh2_tm_ctx *ctx, size_t m, size_t n, size_t np) {
+    const size_t rn = ctx->radial_n;
+    return ctx->radial[(m * rn + n) * rn + np];
+}
+
+/* Converts `(n, ml)` into the numbers of right- and left-circular quanta. */
+static void circular(size_t *p, size_t *q, unsigned n, int ml) {
+    const unsigned m = (unsigned) abs(ml);
+    *p = n + (ml > 0 ? m : 0);
+    *q = n + (ml < 0 ? m : 0);
+}
+
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+/* Calculates the Coulomb matrix element. */
+double clh2_tm_element(clh2_tm_ctx *ctx, const struct clh2_indices *ix) {
+    size_t p1, q1, p2, q2, p3, q3, p4, q4, sp, sq, tp, tq, P, Q;
+    double result = 0;
+    if (ix->ml1 + ix->ml2 != ix->ml3 + ix->ml4)
+        return 0;
+    circular(&p1, &q1, ix->n1, ix->ml1);
+    circular(&p2, &q2, ix->n2, ix->ml2);
+    circular(&p3, &q3, ix->n3, ix->ml3);
+    circular(&p4, &q4, ix->n4, ix->ml4);
+    sp = p1 + p2;
+    sq = q1 + q2;
+    tp = p3 + p4;
+    tq = q3 + q4;
+    /* the relative motion has at most `max(sp, sq, tp, tq)` quanta of either
+       kind, so this bounds both its `|m|` and its principal quantum number */
+    {
+        const size_t s_max = MAX(MAX(sp, sq), MAX(tp, tq));
+        if (load_tables(ctx, s_max, s_max, s_max)) {
+            fprintf(stderr, "clh2_tm_element: "
+                    "can't allocate the memory needed for calculation\n");
+            fflush(stderr);
+            return NAN;
+        }
+    }
+    /* sum over the centre-of-mass quanta `(P, Q)`, which must be the same on
+       both sides; the relative quanta then follow from conservation */
+    for (P = 0; P <= sp && P <= tp; ++P) {
+        const double bp = bracket(ctx, p1, p2, P) * bracket(ctx, p3, p4, P);
+        const size_t rp = sp - P, rpp = tp - P;
+        double sum = 0;
+        if (!bp)
+            continue;
+        for (Q = 0; Q <= sq && Q <= tq; ++Q) {
+            const size_t rq = sq - Q, rqp = tq - Q;
+            sum += bracket(ctx, q1, q2, Q) * bracket(ctx, q3, q4, Q)
+                 * radial(ctx, rp > rq ? rp - rq : rq - rp,
+                          MIN(rp, rq), MIN(rpp, rqp));
+        }
+        result += bp * sum;
+    }
+    return minuspow(ix->n1 + ix->n2 + ix->n3 + ix->n4) * result;
+}
+
+#ifdef __cplusplus
+}
+#endif
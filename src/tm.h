@@ -0,0 +1,65 @@
+#ifndef G_N5SPEFMN3GKWMVQRCCB9D0966JNFJ
+#define G_N5SPEFMN3GKWMVQRCCB9D0966JNFJ
+#include "am.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** A context structure used for the Talmi-Moshinsky transformation.
+
+    The context memoizes the 2D Moshinsky brackets and the radial Coulomb
+    integrals in relative coordinates, so it should be reused across as many
+    matrix elements as possible.
+
+    The structure can be created with `#clh2_tm_ctx_create`.  Once created, it
+    must be later destroyed with `#clh2_tm_ctx_destroy`.
+
+*/
+typedef struct clh2_tm_ctx clh2_tm_ctx;
+
+/** Creates a context.
+
+    @return
+    If successful, a pointer to a valid context.  On failure, `NULL` is
+    returned.
+
+*/
+clh2_tm_ctx *clh2_tm_ctx_create(void);
+
+/** Destroys the context, releasing the memory used by it.
+
+    @param[in] ctx
+    Either a pointer to valid context or `NULL`.
+
+*/
+void clh2_tm_ctx_destroy(clh2_tm_ctx *ctx);
+
+/** Calculates the Coulomb matrix element in a 2D harmonic oscillator basis
+    by transforming to relative and centre-of-mass coordinates.
+
+    Yields the same matrix element as `#clh2_element`, but the cost is only
+    quadratic in the number of oscillator quanta once the brackets and radial
+    integrals are cached.
+
+    @param[in] ctx
+    Pointer to a valid context object.  It shall remain valid after the
+    invocation of this function regardless of whether an error occurs.
+    Must not be `NULL`.
+
+    @param[in] ix
+    Pointer to a structure containing indices that label the matrix element.
+    Must not be `NULL`.
+
+    @return
+    The value of the matrix element, or `NAN` if an error occurs.
+
+    @warning
+    The context must not be shared between threads.
+
+*/
+double clh2_tm_element(clh2_tm_ctx *ctx, const struct clh2_indices *ix);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
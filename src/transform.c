@@ -0,0 +1,169 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <clh2.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of orbitals with a given `ml` within `K` shells. */
+static size_t block_size(int K, int ml) {
+    const int d = K - abs(ml);
+    return d > 0 ? (size_t) (d + 1) / 2 : 0;
+}
+
+/* Number of elements in the channel of `ml1 + ml2 = M`. */
+static size_t channel_size(int K, int M) {
+    size_t n = 0;
+    int ml1, ml3;
+    for (ml1 = 1 - K; ml1 < K; ++ml1)
+    for (ml3 = 1 - K; ml3 < K; ++ml3)
+        n += block_size(K, ml1) * block_size(K, M - ml1) *
+             block_size(K, ml3) * block_size(K, M - ml3);
+    return n;
+}
+
+/* Transforms the middle index of an `outer` by `d` by `inner` array:
+
+       out[o][k][i] = Σ[n] c[n][k] in[o][n][i]
+*/
+static void transform_index(double *out, const double *in, const double *c,
+                            size_t outer, size_t d, size_t inner) {
+    size_t o, k, n, i;
+    for (o = 0; o != outer; ++o)
+    for (k = 0; k != d; ++k) {
+        double *row = out + (o * d + k) * inner;
+        for (i = 0; i != inner; ++i)
+            row[i] = 0;
+        for (n = 0; n != d; ++n) {
+            const double a = c[n * d + k];
+            const double *src = in + (o * d + n) * inner;
+            for (i = 0; i != inner; ++i)
+                row[i] += a * src[i];
+        }
+    }
+}
+
+/* Fills in the indices of the channel `M`, ordered by `ml1`, then `ml3`,
+   and then by the `n` values, so that each combination of `ml` values forms
+   a contiguous block in the canonical order. */
+static void channel_indices(struct clh2_indicesp *args, int K, int M) {
+    int ml1, ml3;
+    unsigned char n1, n2, n3, n4;
+    for (ml1 = 1 - K; ml1 < K; ++ml1)
+    for (ml3 = 1 - K; ml3 < K; ++ml3) {
+        const int ml2 = M - ml1, ml4 = M - ml3;
+        for (n1 = 0; n1 < block_size(K, ml1); ++n1)
+        for (n2 = 0; n2 < block_size(K, ml2); ++n2)
+        for (n3 = 0; n3 < block_size(K, ml3); ++n3)
+        for (n4 = 0; n4 < block_size(K, ml4); ++n4) {
+            args->n1  = n1;
+            args->ml1 = (signed char) ml1;
+            args->n2  = n2;
+            args->ml2 = (signed char) ml2;
+            args->n3  = n3;
+            args->ml3 = (signed char) ml3;
+            args->n4  = n4;
+            args->ml4 = (signed char) ml4;
+            ++args;
+        }
+    }
+}
+
+int clh2_transform(double *values, const char *provider,
+                   const struct clh2_spec *spec,
+                   const double *const *coeffs) {
+    struct clh2_indicesp *args = NULL;
+    double *buf = NULL;
+    size_t count, max_channel = 0, max_block, *offsets = NULL, pos;
+    int K, M, ml1, ml2, e;
+
+    if (!spec || spec->truncation != CLH2_TRUNCATE_ORBITALS ||
+        spec->min_shells || spec->all_ml)
+        return EINVAL;
+    e = clh2_spec_enumerate(&count, NULL, spec);
+    if (e || !count)
+        return e;
+    if (!values || !coeffs)
+        return EINVAL;
+    K = spec->num_shells;
+
+    /* where each pair of `ml1` and `ml2` starts in the canonical order */
+    offsets = (size_t *) malloc((size_t) (2 * K - 1) * (size_t) (2 * K - 1) *
+                                sizeof(*offsets));
+    if (!offsets)
+        return ENOMEM;
+    pos = 0;
+    for (ml1 = 1 - K; ml1 < K; ++ml1)
+    for (ml2 = 1 - K; ml2 < K; ++ml2) {
+        int ml3;
+        offsets[(ml1 + K - 1) * (2 * K - 1) + ml2 + K - 1] = pos;
+        for (ml3 = 1 - K; ml3 < K; ++ml3)
+            pos += block_size(K, ml1) * block_size(K, ml2) *
+                   block_size(K, ml3) * block_size(K, ml1 + ml2 - ml3);
+    }
+
+    /* a single channel of indices, and two scratch blocks */
+    for (M = 2 - 2 * K; M <= 2 * K - 2; ++M) {
+        const size_t n = channel_size(K, M);
+        if (n > max_channel)
+            max_channel = n;
+    }
+    max_block = block_size(K, 0) * block_size(K, 0);
+    max_block *= max_block;
+    args = (struct clh2_indicesp *) malloc(max_channel * sizeof(*args));
+    buf = (double *) malloc(2 * max_block * sizeof(*buf));
+    if (!args || !buf) {
+        e = ENOMEM;
+        goto done;
+    }
+
+    for (M = 2 - 2 * K; M <= 2 * K - 2; ++M) {
+        const size_t n = channel_size(K, M);
+        const double *v, *in;
+        int ml3;
+        if (!n)
+            continue;
+        channel_indices(args, K, M);
+        e = spec->antisym ? clh2_request_antisym(&v, provider, n, args) :
+                            clh2_request(&v, provider, n, args);
+        if (e)
+            break;
+
+        /* transform each block, one index at a time */
+        in = v;
+        for (ml1 = 1 - K; ml1 < K; ++ml1) {
+            const size_t d1 = block_size(K, ml1);
+            const size_t d2 = block_size(K, M - ml1);
+            if (!d1 || !d2)
+                continue;
+            pos = offsets[(ml1 + K - 1) * (2 * K - 1) + M - ml1 + K - 1];
+            for (ml3 = 1 - K; ml3 < K; ++ml3) {
+                const size_t d3 = block_size(K, ml3);
+                const size_t d4 = block_size(K, M - ml3);
+                if (!d3 || !d4)
+                    continue;
+                transform_index(buf, in, coeffs[M - ml3 + K - 1],
+                                d1 * d2 * d3, d4, 1);
+                transform_index(buf + max_block, buf, coeffs[ml3 + K - 1],
+                                d1 * d2, d3, d4);
+                transform_index(buf, buf + max_block, coeffs[M - ml1 + K - 1],
+                                d1, d2, d3 * d4);
+                transform_index(values + pos, buf, coeffs[ml1 + K - 1],
+                                1, d1, d2 * d3 * d4);
+                in += d1 * d2 * d3 * d4;
+                pos += d1 * d2 * d3 * d4;
+            }
+        }
+        clh2_free(n, v);
+    }
+
+done:
+    free(offsets);
+    free(args);
+    free(buf);
+    return e;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -56,7 +56,6 @@ int rf_tmpfile(char **path, int *fd, const char *name) {
     const size_t len_xs = strlen(xs);
     size_t bufsz = 0;
     char *p, *buf;
-    mode_t mode;
     int e, f;
 
     if (!path && !fd)
@@ -96,12 +95,18 @@ int rf_tmpfile(char **path, int *fd, const char *name) {
     p += len_xs;
     *p = '\0';
 
-    /* use mask to ensure 0600 even on non-compliant systems */
-    mode = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+    /* ensure 0600 even on non-compliant systems; the umask can't be used for
+       this since it is shared with the other threads */
     f = mkstemp(buf);
-    e = errno;
-    (void) umask(mode);
     if (f == -1) {
+        e = errno;
+        free(buf);
+        return e;
+    }
+    if (fchmod(f, S_IRUSR | S_IWUSR)) {
+        e = errno;
+        (void) rf_close(f);
+        (void) unlink(buf);
         free(buf);
         return e;
     }